@@ -1,5 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
 
 void ap_write(int v)
 {
@@ -19,3 +27,373 @@ int ap_read(char *s)
     }
     return val;
 }
+
+/* profiling counters of a program compiled with -instrument */
+static unsigned long long **ap_counters;
+static int ap_num_counters;
+
+/* write the counters to $AP_PROFILE_FILE (ap.prof by default), adding the counts
+   already there if they were collected from the same program */
+static void ap_profile_dump(void)
+{
+    const char *path = getenv("AP_PROFILE_FILE");
+    FILE *f;
+    int i, n;
+
+    if (!path)
+        path = "ap.prof";
+
+    f = fopen(path, "r");
+    if (f)
+    {
+        if (fscanf(f, "%d", &n) == 1 && n == ap_num_counters)
+        {
+            unsigned long long count;
+            for (i = 0; i < n && fscanf(f, "%llu", &count) == 1; i++)
+                *ap_counters[i] += count;
+        }
+        fclose(f);
+    }
+
+    f = fopen(path, "w");
+    if (!f)
+    {
+        fprintf(stderr, "Cannot write profile %s\n", path);
+        return;
+    }
+    fprintf(f, "%d\n", ap_num_counters);
+    for (i = 0; i < ap_num_counters; i++)
+        fprintf(f, "%llu\n", *ap_counters[i]);
+    fclose(f);
+}
+
+void ap_profile_init(unsigned long long **counters, int n)
+{
+    ap_counters = counters;
+    ap_num_counters = n;
+    atexit(ap_profile_dump);
+}
+
+/* values of the external variables of a program compiled with -extern-vars */
+static int *ap_inputs;
+
+/* the whole input, mapped if it is a regular file and read otherwise */
+static const char *ap_load_input(int fd, size_t *size)
+{
+    struct stat st;
+    char *buf;
+    size_t cap, len;
+    ssize_t n;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED)
+        {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            *size = st.st_size;
+            return map;
+        }
+    }
+
+    cap = 1 << 16;
+    len = 0;
+    buf = malloc(cap);
+    while (buf && (n = read(fd, buf + len, cap - len)) > 0)
+    {
+        len += n;
+        if (len == cap)
+            buf = realloc(buf, cap *= 2);
+    }
+    if (!buf)
+    {
+        fprintf(stderr, "Out of memory reading the input\n");
+        exit(1);
+    }
+    *size = len;
+    return buf;
+}
+
+/* read n integers separated by whitespace or commas from $AP_INPUT_FILE, or stdin
+   if it is not set, and return them; called once when the program starts */
+int *ap_read_inputs(int n)
+{
+    const char *path = getenv("AP_INPUT_FILE");
+    const char *p, *end;
+    size_t size;
+    int fd = 0, i;
+
+    if (path && (fd = open(path, O_RDONLY)) < 0)
+    {
+        fprintf(stderr, "Cannot open input %s\n", path);
+        exit(1);
+    }
+    p = ap_load_input(fd, &size);
+    end = p + size;
+
+    ap_inputs = malloc(n * sizeof(int));
+    for (i = 0; i < n; i++)
+    {
+        unsigned int val = 0;
+        int neg = 0;
+
+        while (p < end && (*p == ' ' || *p == ',' || *p == '\n' || *p == '\r' || *p == '\t'))
+            p++;
+        if (p < end && (*p == '-' || *p == '+'))
+            neg = *p++ == '-';
+        if (p == end || *p < '0' || *p > '9')
+        {
+            fprintf(stderr, "Input value %d is missing or invalid\n", i + 1);
+            exit(1);
+        }
+        while (p < end && *p >= '0' && *p <= '9')
+            val = val * 10 + (*p++ - '0');
+        ap_inputs[i] = neg ? -val : val;
+    }
+    return ap_inputs;
+}
+
+/* a program compiled with -batch: evaluates n tuples, reading column k of tuple j
+   from columns[k][j] and storing its result to results[j] */
+typedef void (*ap_batch_fn)(int **columns, int *results, long long n);
+
+/* write the results as text, one per line, through a large buffer */
+static void ap_print_results(const int *results, long long n)
+{
+    char buf[1 << 16];
+    size_t len = 0;
+    long long j;
+
+    for (j = 0; j < n; j++)
+    {
+        char digits[12];
+        int k = 0;
+        unsigned int val = results[j] < 0 ? -(unsigned int)results[j] : (unsigned int)results[j];
+
+        if (len > sizeof(buf) - 16)
+        {
+            fwrite(buf, 1, len, stdout);
+            len = 0;
+        }
+        if (results[j] < 0)
+            buf[len++] = '-';
+        do
+            digits[k++] = '0' + val % 10;
+        while (val /= 10);
+        while (k)
+            buf[len++] = digits[--k];
+        buf[len++] = '\n';
+    }
+    fwrite(buf, 1, len, stdout);
+}
+
+/* A batch is cut into chunks of consecutive tuples, and every worker thread starts
+   with an equal share of them. A worker takes chunks from the front of its own
+   range, and once it is empty steals the back half of another worker's range. A
+   range of chunk indices [begin, end) is packed into one word, so the owner and the
+   thieves claim chunks with a compare-and-swap. Chunks write disjoint parts of the
+   results, which therefore need no locking. */
+struct ap_worker
+{
+    _Alignas(64) _Atomic unsigned long long range;
+    pthread_t thread;
+    int id;
+};
+
+#define AP_RANGE(begin, end) ((unsigned long long)(begin) << 32 | (end))
+
+static struct
+{
+    ap_batch_fn fn;
+    int **columns;
+    int *results;
+    int ncols;
+    long long n, chunk;
+    int nthreads;
+    struct ap_worker *workers;
+} ap_job;
+
+/* the first chunk of the worker's own range, or -1 if it is empty */
+static long long ap_pop_chunk(struct ap_worker *w)
+{
+    unsigned long long r = atomic_load(&w->range);
+    for (;;)
+    {
+        unsigned int begin = r >> 32, end = (unsigned int)r;
+        if (begin >= end)
+            return -1;
+        if (atomic_compare_exchange_weak(&w->range, &r, AP_RANGE(begin + 1, end)))
+            return begin;
+    }
+}
+
+/* move the back half of the victim's range to the thief, whose range is empty */
+static int ap_steal_chunks(struct ap_worker *thief, struct ap_worker *victim)
+{
+    unsigned long long r = atomic_load(&victim->range);
+    for (;;)
+    {
+        unsigned int begin = r >> 32, end = (unsigned int)r, mid;
+        if (begin >= end)
+            return 0;
+        mid = begin + (end - begin) / 2;
+        if (atomic_compare_exchange_weak(&victim->range, &r, AP_RANGE(begin, mid)))
+        {
+            atomic_store(&thief->range, AP_RANGE(mid, end));
+            return 1;
+        }
+    }
+}
+
+/* run chunks until no worker has any left; chunks stolen but not yet published by
+   another thief are that thief's to run */
+static void *ap_worker_main(void *arg)
+{
+    struct ap_worker *w = arg;
+    int *columns[ap_job.ncols + 1];
+    long long c;
+    int i, k;
+
+    for (;;)
+    {
+        while ((c = ap_pop_chunk(w)) >= 0)
+        {
+            long long start = c * ap_job.chunk;
+            long long len = ap_job.n - start < ap_job.chunk ? ap_job.n - start : ap_job.chunk;
+            for (k = 0; k < ap_job.ncols; k++)
+                columns[k] = ap_job.columns[k] + start;
+            ap_job.fn(columns, ap_job.results + start, len);
+        }
+        for (i = 1; i < ap_job.nthreads; i++)
+            if (ap_steal_chunks(w, &ap_job.workers[(w->id + i) % ap_job.nthreads]))
+                break;
+        if (i >= ap_job.nthreads)
+            return NULL;
+    }
+}
+
+/* evaluate the n tuples on $AP_THREADS threads (one per online processor by
+   default) in chunks of $AP_CHUNK_SIZE tuples */
+static void ap_run_parallel(ap_batch_fn fn, int **columns, int ncols, int *results, long long n)
+{
+    const char *threads = getenv("AP_THREADS");
+    const char *chunk = getenv("AP_CHUNK_SIZE");
+    long long nchunks;
+    int i;
+
+    ap_job.fn = fn;
+    ap_job.columns = columns;
+    ap_job.results = results;
+    ap_job.ncols = ncols;
+    ap_job.n = n;
+    ap_job.chunk = chunk ? atoll(chunk) : 16384;
+    if (ap_job.chunk < 1)
+        ap_job.chunk = 1;
+    /* chunk indices must fit in half a word */
+    if ((n + ap_job.chunk - 1) / ap_job.chunk > 0xffffffffLL)
+        ap_job.chunk = (n + 0xfffffffeLL) / 0xffffffffLL;
+    nchunks = (n + ap_job.chunk - 1) / ap_job.chunk;
+
+    ap_job.nthreads = threads ? atoi(threads) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (ap_job.nthreads > nchunks)
+        ap_job.nthreads = nchunks;
+    if (ap_job.nthreads < 1)
+        ap_job.nthreads = 1;
+    if (ap_job.nthreads == 1)
+    {
+        fn(columns, results, n);
+        return;
+    }
+
+    ap_job.workers = aligned_alloc(64, ap_job.nthreads * sizeof(struct ap_worker));
+    if (!ap_job.workers)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < ap_job.nthreads; i++)
+    {
+        ap_job.workers[i].id = i;
+        atomic_init(&ap_job.workers[i].range,
+                    AP_RANGE(nchunks * i / ap_job.nthreads, nchunks * (i + 1) / ap_job.nthreads));
+    }
+    /* the calling thread is worker 0 */
+    for (i = 1; i < ap_job.nthreads; i++)
+        if (pthread_create(&ap_job.workers[i].thread, NULL, ap_worker_main, &ap_job.workers[i]))
+        {
+            fprintf(stderr, "Cannot create worker thread\n");
+            exit(1);
+        }
+    ap_worker_main(&ap_job.workers[0]);
+    for (i = 1; i < ap_job.nthreads; i++)
+        pthread_join(ap_job.workers[i].thread, NULL);
+    free(ap_job.workers);
+}
+
+/* run a batch program over a columnar input: the file named by the first argument
+   or $AP_INPUT_FILE, or stdin, holds ncols arrays of native 32-bit integers one after
+   the other, all of the same length. The results are printed one per line, or
+   written as one such array to $AP_OUTPUT_FILE if it is set. The tuples are
+   evaluated in parallel, see ap_run_parallel; with $AP_STATS set the throughput is
+   reported on stderr. */
+int ap_run_batch(int argc, char **argv, int ncols, ap_batch_fn fn)
+{
+    const char *path = argc > 1 ? argv[1] : getenv("AP_INPUT_FILE");
+    const char *out = getenv("AP_OUTPUT_FILE");
+    const char *data;
+    size_t size;
+    long long n = 1;
+    int **columns, *results;
+    int fd = 0, k;
+    struct timespec t0, t1;
+    double seconds;
+
+    if (path && (fd = open(path, O_RDONLY)) < 0)
+    {
+        fprintf(stderr, "Cannot open input %s\n", path);
+        return 1;
+    }
+    data = ap_load_input(fd, &size);
+    if (ncols)
+    {
+        if (size % (ncols * sizeof(int)))
+        {
+            fprintf(stderr, "Input size is not a multiple of %d columns\n", ncols);
+            return 1;
+        }
+        n = size / (ncols * sizeof(int));
+    }
+
+    columns = malloc((ncols ? ncols : 1) * sizeof(int *));
+    results = malloc((n ? n : 1) * sizeof(int));
+    if (!columns || !results)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    for (k = 0; k < ncols; k++)
+        columns[k] = (int *)data + k * n;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    ap_run_parallel(fn, columns, ncols, results, n);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (getenv("AP_STATS"))
+    {
+        seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        fprintf(stderr, "%lld tuples on %d thread(s) in %.3f ms: %.1f M tuples/s\n",
+                n, ap_job.nthreads ? ap_job.nthreads : 1, seconds * 1e3, n / seconds / 1e6);
+    }
+
+    if (out)
+    {
+        FILE *f = fopen(out, "wb");
+        if (!f || fwrite(results, sizeof(int), n, f) != (size_t)n || fclose(f))
+        {
+            fprintf(stderr, "Cannot write output %s\n", out);
+            return 1;
+        }
+    }
+    else
+        ap_print_results(results, n);
+    return 0;
+}
@@ -3,7 +3,12 @@
 #include "Sema.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/InitLLVM.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Timer.h"
 #include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <memory>
 
 // Define a command-line option for specifying the input expression.
 static llvm::cl::opt<std::string>
@@ -11,23 +16,232 @@ static llvm::cl::opt<std::string>
           llvm::cl::desc("<input expression>"),
           llvm::cl::init(""));
 
+// Read the program from a file instead of the command line.
+static llvm::cl::opt<std::string>
+    InputFile("input-file",
+              llvm::cl::desc("Read the program from <file> (- for stdin)"),
+              llvm::cl::value_desc("file"),
+              llvm::cl::init(""));
+
+// Compile without ever holding the whole AST in memory.
+static llvm::cl::opt<bool>
+    Stream("stream",
+           llvm::cl::desc("Analyze and compile the program one statement at a time"),
+           llvm::cl::init(false));
+
+// Stop reporting syntax errors after this many, 0 means no limit.
+static llvm::cl::opt<unsigned>
+    ErrorLimit("error-limit",
+               llvm::cl::desc("Maximum number of syntax errors to report (0 = no limit)"),
+               llvm::cl::init(20));
+
+// Run the original separate Sema, identifier collection and dependency passes
+// after the fused analysis and check that they agree.
+static llvm::cl::opt<bool>
+    ValidateAnalysis("validate-analysis",
+                     llvm::cl::desc("Cross-check the fused front end against the separate passes"),
+                     llvm::cl::init(false));
+
+// Parse expressions with the recursive descent parser, one function per precedence
+// level, instead of the precedence climbing one.
+static llvm::cl::opt<bool>
+    RecursiveDescent("recursive-descent",
+                     llvm::cl::desc("Parse expressions by recursive descent instead of precedence climbing"),
+                     llvm::cl::init(false));
+
+// Parse the program a second time with the other expression parser and check that
+// both trees are identical.
+static llvm::cl::opt<bool>
+    VerifyParser("verify-parser",
+                 llvm::cl::desc("Cross-check the precedence climbing parser against the recursive descent one"),
+                 llvm::cl::init(false));
+
+// Interpret the program before and after the AST optimizations and check that both
+// runs report the same values (not with -stream).
+static llvm::cl::opt<bool>
+    VerifyOptimizer("verify-optimizer",
+                    llvm::cl::desc("Cross-check the AST optimizations by interpreting the program before and after them"),
+                    llvm::cl::init(false));
+
+// Execute the program on the bytecode interpreter instead of emitting LLVM IR. The
+// interpreter runs the tree the AST optimizations produced, like code generation.
+static llvm::cl::opt<bool>
+    Interp("interp",
+           llvm::cl::desc("Run the program on the bytecode interpreter instead of compiling it"),
+           llvm::cl::init(false));
+
+// Interpret the program, compiling loops to native code once they get hot.
+static llvm::cl::opt<bool>
+    Tiered("tiered",
+           llvm::cl::desc("Interpret the program and compile its hot loops with a JIT"),
+           llvm::cl::init(false));
+
+// Stop after the dead variable analysis and write its results as JSON, without
+// building any IR.
+static llvm::cl::opt<bool>
+    AnalyzeOnly("analyze-only",
+                llvm::cl::desc("Only analyze the program and write the live and dead variables as JSON"),
+                llvm::cl::init(false));
+
+// whether A and B are the same tree, down to the ids of the assignments
+static bool isSameTree(AST *A, AST *B)
+{
+    if (isStackNearlyExhausted())
+        return runOnNewStack([&] { return isSameTree(A, B); });
+    if (!A || !B)
+        return A == B;
+    if (A->getASTKind() != B->getASTKind())
+        return false;
+
+    auto SameExprs = [](auto BeginA, auto EndA, auto BeginB, auto EndB) {
+        return std::equal(BeginA, EndA, BeginB, EndB,
+                          [](AST *X, AST *Y) { return isSameTree(X, Y); });
+    };
+
+    switch (A->getASTKind())
+    {
+    case AST::AK_AP:
+    {
+        auto *X = llvm::cast<AP>(A), *Y = llvm::cast<AP>(B);
+        return SameExprs(X->begin(), X->end(), Y->begin(), Y->end());
+    }
+    case AST::AK_Factor:
+    {
+        auto *X = llvm::cast<Factor>(A), *Y = llvm::cast<Factor>(B);
+        return X->getKind() == Y->getKind() && X->getVal() == Y->getVal();
+    }
+    case AST::AK_BinaryOp:
+    {
+        auto *X = llvm::cast<BinaryOp>(A), *Y = llvm::cast<BinaryOp>(B);
+        return X->getOperator() == Y->getOperator() &&
+               isSameTree(X->getLeft(), Y->getLeft()) && isSameTree(X->getRight(), Y->getRight());
+    }
+    case AST::AK_Assignment:
+    {
+        auto *X = llvm::cast<Assignment>(A), *Y = llvm::cast<Assignment>(B);
+        return X->getOperator() == Y->getOperator() && X->getId() == Y->getId() &&
+               isSameTree(X->getLeft(), Y->getLeft()) && isSameTree(X->getRight(), Y->getRight());
+    }
+    case AST::AK_Declaration:
+    {
+        auto *X = llvm::cast<Declaration>(A), *Y = llvm::cast<Declaration>(B);
+        return std::equal(X->beginVars(), X->endVars(), Y->beginVars(), Y->endVars()) &&
+               SameExprs(X->beginExprs(), X->endExprs(), Y->beginExprs(), Y->endExprs());
+    }
+    case AST::AK_IfElse:
+    {
+        auto *X = llvm::cast<IfElse>(A), *Y = llvm::cast<IfElse>(B);
+        return X->getHasElse() == Y->getHasElse() &&
+               SameExprs(X->beginExprs(), X->endExprs(), Y->beginExprs(), Y->endExprs()) &&
+               std::equal(X->beginAssigns2D(), X->endAssigns2D(), Y->beginAssigns2D(), Y->endAssigns2D(),
+                          [&](const auto &XA, const auto &YA) {
+                              return SameExprs(XA.begin(), XA.end(), YA.begin(), YA.end());
+                          });
+    }
+    case AST::AK_Loop:
+    {
+        auto *X = llvm::cast<Loop>(A), *Y = llvm::cast<Loop>(B);
+        return isSameTree(X->getCondition(), Y->getCondition()) &&
+               SameExprs(X->begin(), X->end(), Y->begin(), Y->end());
+    }
+    }
+    return false;
+}
+
+// Streaming mode: the source is parsed twice, the first time to compute the
+// dependencies of every variable and the second time to emit IR, and each statement
+// is freed as soon as it has been processed.
+static int compileStreaming(llvm::StringRef Source)
+{
+    CodeGen CodeGenerator;
+
+    Lexer AnalysisLex(Source);
+    Parser AnalysisParser(AnalysisLex, ErrorLimit);
+    AnalysisParser.setPrecedenceClimbing(!RecursiveDescent);
+    bool SemanticError = CodeGenerator.analyzeStreaming(AnalysisParser);
+    if (AnalysisParser.hasError())
+    {
+        llvm::errs() << "Syntax errors occurred\n";
+        return 1;
+    }
+    if (SemanticError)
+    {
+        llvm::errs() << "Semantic errors occurred\n";
+        return 1;
+    }
+
+    CodeGenerator.computeDead(!AnalyzeOnly);
+    if (AnalyzeOnly)
+    {
+        CodeGenerator.writeAnalysis(llvm::outs());
+        return 0;
+    }
+
+    Lexer Lex(Source);
+    Parser Parser(Lex, ErrorLimit);
+    Parser.setPrecedenceClimbing(!RecursiveDescent);
+    // statements are freed as soon as they ran, so -tiered has no loops to hand over
+    if (Interp || Tiered)
+        return CodeGenerator.interpretStreaming(Parser);
+    return CodeGenerator.compileStreaming(Parser);
+}
+
 // The main function of the program.
 int main(int argc, const char **argv)
 {
     // Initialize the LLVM framework.
     llvm::InitLLVM X(argc, argv);
+    noteBottomOfMainStack();
 
     // Parse command-line options.
     llvm::cl::ParseCommandLineOptions(argc, argv, "AP - the expression compiler\n");
 
+    // Read the program from the input file if one was given.
+    llvm::StringRef Source = Input;
+    std::unique_ptr<llvm::MemoryBuffer> Buffer;
+    if (!InputFile.empty())
+    {
+        auto FileOrErr = llvm::MemoryBuffer::getFileOrSTDIN(InputFile);
+        if (std::error_code EC = FileOrErr.getError())
+        {
+            llvm::errs() << "Cannot read " << InputFile << ": " << EC.message() << "\n";
+            return 1;
+        }
+        Buffer = std::move(*FileOrErr);
+        Source = Buffer->getBuffer();
+    }
+
+    if (Stream)
+        return compileStreaming(Source);
+
     // Create a lexer object and initialize it with the input expression.
-    Lexer Lex(Input);
+    Lexer Lex(Source);
 
     // Create a parser object and initialize it with the lexer.
-    Parser Parser(Lex);
+    Parser Parser(Lex, ErrorLimit);
+    Parser.setPrecedenceClimbing(!RecursiveDescent);
 
     // Parse the input expression and generate an abstract syntax tree (AST).
-    AST *Tree = Parser.parse();
+    std::unique_ptr<AST> Tree;
+    {
+        llvm::NamedRegionTimer T("parse", "Parsing", "ap", "AP compiler phases",
+                                 llvm::TimePassesIsEnabled);
+        Tree.reset(Parser.parse());
+    }
+
+    // In verification mode, parse the program again with the other expression parser.
+    if (VerifyParser)
+    {
+        Lexer OtherLex(Source);
+        class Parser OtherParser(OtherLex, ErrorLimit);
+        OtherParser.setPrecedenceClimbing(RecursiveDescent);
+        std::unique_ptr<AST> OtherTree(OtherParser.parse());
+        if (!isSameTree(Tree.get(), OtherTree.get()) || Parser.hasError() != OtherParser.hasError())
+        {
+            llvm::errs() << "Parser verification failed\n";
+            return 1;
+        }
+    }
 
     // Check if parsing was successful or if there were any syntax errors.
     if (!Tree || Parser.hasError())
@@ -36,21 +250,48 @@ int main(int argc, const char **argv)
         return 1;
     }
 
-    // Perform semantic analysis on the AST.
-    Sema Semantic;
-    if (Semantic.semantic(Tree))
+    // Perform semantic analysis, identifier collection and dependency
+    // computation on the AST in a single traversal.
+    CodeGen CodeGenerator;
+    bool SemanticError;
+    {
+        llvm::NamedRegionTimer T("analysis", "Front-end analysis", "ap", "AP compiler phases",
+                                 llvm::TimePassesIsEnabled);
+        SemanticError = CodeGenerator.analyze(Tree.get());
+    }
+    if (SemanticError)
     {
         llvm::errs() << "Semantic errors occurred\n";
         return 1;
     }
 
-    // Generate code for the AST using a code generator.
-    CodeGen CodeGenerator;
-    CodeGenerator.collectIdentifiers(Tree);
-    CodeGenerator.computeDepends(Tree);
-    CodeGenerator.computeDead();
-    CodeGenerator.compile(Tree);
+    // In validation mode, rerun the separate passes and compare their results.
+    if (ValidateAnalysis)
+    {
+        Sema Semantic;
+        if (Semantic.semantic(Tree.get()) || CodeGenerator.verifyAnalysis(Tree.get()))
+        {
+            llvm::errs() << "Analysis validation failed\n";
+            return 1;
+        }
+    }
 
-    // The program executed successfully.
-    return 0;
+    // Generate code for the AST using a code generator.
+    CodeGenerator.computeDead(!AnalyzeOnly);
+    if (AnalyzeOnly)
+    {
+        CodeGenerator.writeAnalysis(llvm::outs());
+        return 0;
+    }
+    // In verification mode, check the AST optimizations against the interpreter.
+    if (VerifyOptimizer && CodeGenerator.verifyOptimizations(Tree.get()))
+    {
+        llvm::errs() << "Optimizer verification failed\n";
+        return 1;
+    }
+    if (Tiered)
+        return CodeGenerator.runTiered(Tree.get());
+    if (Interp)
+        return CodeGenerator.interpret(Tree.get());
+    return CodeGenerator.compile(Tree.get());
 }
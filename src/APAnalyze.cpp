@@ -0,0 +1,66 @@
+#include "CodeGen.h"
+#include "Parser.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+// ap-analyze runs the front end and the dead variable analysis of ap -analyze-only
+// and writes their results as JSON. It links only LLVM's Support library, so it
+// starts much faster than ap.
+
+static llvm::cl::opt<std::string>
+    Input(llvm::cl::Positional,
+          llvm::cl::desc("<input expression>"),
+          llvm::cl::init(""));
+
+static llvm::cl::opt<std::string>
+    InputFile("input-file",
+              llvm::cl::desc("Read the program from <file> (- for stdin)"),
+              llvm::cl::value_desc("file"),
+              llvm::cl::init(""));
+
+static llvm::cl::opt<unsigned>
+    ErrorLimit("error-limit",
+               llvm::cl::desc("Maximum number of syntax errors to report (0 = no limit)"),
+               llvm::cl::init(20));
+
+int main(int argc, const char **argv)
+{
+    llvm::InitLLVM X(argc, argv);
+    noteBottomOfMainStack();
+    llvm::cl::ParseCommandLineOptions(argc, argv, "AP analyzer - live and dead variables as JSON\n");
+
+    llvm::StringRef Source = Input;
+    std::unique_ptr<llvm::MemoryBuffer> Buffer;
+    if (!InputFile.empty())
+    {
+        auto FileOrErr = llvm::MemoryBuffer::getFileOrSTDIN(InputFile);
+        if (std::error_code EC = FileOrErr.getError())
+        {
+            llvm::errs() << "Cannot read " << InputFile << ": " << EC.message() << "\n";
+            return 1;
+        }
+        Buffer = std::move(*FileOrErr);
+        Source = Buffer->getBuffer();
+    }
+
+    Lexer Lex(Source);
+    Parser Parser(Lex, ErrorLimit);
+    AST *Tree = Parser.parse();
+    if (!Tree || Parser.hasError())
+    {
+        llvm::errs() << "Syntax errors occurred\n";
+        return 1;
+    }
+
+    CodeGen CodeGenerator;
+    if (CodeGenerator.analyze(Tree))
+    {
+        llvm::errs() << "Semantic errors occurred\n";
+        return 1;
+    }
+    CodeGenerator.computeDead(false);
+    CodeGenerator.writeAnalysis(llvm::outs());
+    return 0;
+}
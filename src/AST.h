@@ -1,8 +1,10 @@
 #ifndef AST_H
 #define AST_H
 
+#include "Stack.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Casting.h"
 
 // Forward declarations of classes used in the AST
 class AST;
@@ -36,7 +38,27 @@ public:
 class AST
 {
 public:
+  // Kind tag of the concrete node, used for static dispatch and llvm::isa/dyn_cast
+  enum ASTKind
+  {
+    AK_AP,
+    AK_Factor,
+    AK_BinaryOp,
+    AK_Assignment,
+    AK_Declaration,
+    AK_IfElse,
+    AK_Loop
+  };
+
+private:
+  const ASTKind NodeKind;
+
+public:
+  AST(ASTKind K) : NodeKind(K) {}
   virtual ~AST() {}
+
+  ASTKind getASTKind() const { return NodeKind; }
+
   virtual void accept(ASTVisitor &V) = 0; // Accept a visitor for traversal
 };
 
@@ -44,7 +66,7 @@ public:
 class Expr : public AST
 {
 public:
-  Expr() {}
+  Expr(ASTKind K) : AST(K) {}
 };
 
 // AP class represents a group of expressions in the AST
@@ -56,7 +78,13 @@ private:
   ExprVector exprs; // Stores the list of expressions
 
 public:
-  AP(llvm::SmallVector<Expr *> exprs) : exprs(exprs) {}
+  AP(llvm::SmallVector<Expr *> exprs) : Expr(AK_AP), exprs(exprs) {}
+
+  ~AP()
+  {
+    for (Expr *E : exprs)
+      delete E;
+  }
 
   llvm::SmallVector<Expr *> getExprs() { return exprs; }
 
@@ -64,10 +92,15 @@ public:
 
   ExprVector::const_iterator end() { return exprs.end(); }
 
+  // the statements removed are not deleted
+  void setExprs(llvm::SmallVector<Expr *> E) { exprs = E; }
+
   virtual void accept(ASTVisitor &V) override
   {
     V.visit(*this);
   }
+
+  static bool classof(const AST *A) { return A->getASTKind() == AK_AP; }
 };
 
 // Factor class represents a factor in the AST (either an identifier or a number)
@@ -85,7 +118,7 @@ private:
   llvm::StringRef Val; // Stores the value of the factor
 
 public:
-  Factor(ValueKind Kind, llvm::StringRef Val) : Kind(Kind), Val(Val) {}
+  Factor(ValueKind Kind, llvm::StringRef Val) : Expr(AK_Factor), Kind(Kind), Val(Val) {}
 
   ValueKind getKind() { return Kind; }
 
@@ -95,6 +128,8 @@ public:
   {
     V.visit(*this);
   }
+
+  static bool classof(const AST *A) { return A->getASTKind() == AK_Factor; }
 };
 
 // BinaryOp class represents a binary operation in the AST (plus, minus, multiplication, division)
@@ -116,7 +151,13 @@ public:
     Mul,
     Div,
     Mod,
-    Pow
+    Pow,
+    // produced by the optimizer only, never by the parser
+    Shl,
+    AShr,
+    LShr,
+    BitAnd,
+    MulHi // high 32 bits of the signed 64-bit product
   };
 
 private:
@@ -125,7 +166,25 @@ private:
   Operator Op; // Operator of the binary operation
 
 public:
-  BinaryOp(Operator Op, Expr *L, Expr *R) : Op(Op), Left(L), Right(R) {}
+  BinaryOp(Operator Op, Expr *L, Expr *R) : Expr(AK_BinaryOp), Left(L), Right(R), Op(Op) {}
+
+  ~BinaryOp()
+  {
+    // nested operations are deleted from a worklist, deep trees would overflow the stack
+    llvm::SmallVector<Expr *> Worklist = {Left, Right};
+    while (!Worklist.empty())
+    {
+      Expr *E = Worklist.pop_back_val();
+      if (E && E->getASTKind() == AK_BinaryOp)
+      {
+        auto *B = static_cast<BinaryOp *>(E);
+        Worklist.push_back(B->Left);
+        Worklist.push_back(B->Right);
+        B->Left = B->Right = nullptr;
+      }
+      delete E;
+    }
+  }
 
   Expr *getLeft() { return Left; }
 
@@ -133,10 +192,18 @@ public:
 
   Operator getOperator() { return Op; }
 
+  void setLeft(Expr *L) { Left = L; }
+
+  void setRight(Expr *R) { Right = R; }
+
+  void setOperator(Operator O) { Op = O; }
+
   virtual void accept(ASTVisitor &V) override
   {
     V.visit(*this);
   }
+
+  static bool classof(const AST *A) { return A->getASTKind() == AK_BinaryOp; }
 };
 
 // Assignment class represents an assignment expression in the AST
@@ -157,9 +224,16 @@ private:
   Factor *Left; // Left-hand side factor (identifier)
   Expr *Right; // Right-hand side expression
   Operator Op; // Operator of the assignment operation
+  unsigned Id; // position in the source, stable across parses of the same input; 0 if none
 
 public:
-  Assignment(Operator Op, Factor *L, Expr *R) : Op(Op), Left(L), Right(R) {}
+  Assignment(Operator Op, Factor *L, Expr *R, unsigned Id = 0) : Expr(AK_Assignment), Left(L), Right(R), Op(Op), Id(Id) {}
+
+  ~Assignment()
+  {
+    delete Left;
+    delete Right;
+  }
 
   Factor *getLeft() { return Left; }
 
@@ -167,10 +241,18 @@ public:
 
   Operator getOperator() { return Op; }
 
+  unsigned getId() { return Id; }
+
+  void setRight(Expr *R) { Right = R; }
+
+  void setOperator(Operator O) { Op = O; }
+
   virtual void accept(ASTVisitor &V) override
   {
     V.visit(*this);
   }
+
+  static bool classof(const AST *A) { return A->getASTKind() == AK_Assignment; }
 };
 
 // Declaration class represents a variable declaration with an initializer in the AST
@@ -184,7 +266,13 @@ class Declaration : public Expr
   // boolean visit = True + getter
 
 public:
-  Declaration(llvm::SmallVector<llvm::StringRef, 8> Vars, llvm::SmallVector<Expr *> Exprs) : Vars(Vars), Exprs(Exprs) {}
+  Declaration(llvm::SmallVector<llvm::StringRef, 8> Vars, llvm::SmallVector<Expr *> Exprs) : Expr(AK_Declaration), Vars(Vars), Exprs(Exprs) {}
+
+  ~Declaration()
+  {
+    for (Expr *E : Exprs)
+      delete E;
+  }
 
   VarVector::const_iterator beginVars() { return Vars.begin(); }
 
@@ -194,10 +282,14 @@ public:
 
   ExprVector::const_iterator endExprs() { return Exprs.end(); }
 
+  void setExpr(size_t I, Expr *E) { Exprs[I] = E; }
+
   virtual void accept(ASTVisitor &V) override
   {
     V.visit(*this);
   }
+
+  static bool classof(const AST *A) { return A->getASTKind() == AK_Declaration; }
 };
 
 // IfElse class represents a condition in the AST
@@ -211,7 +303,16 @@ class IfElse : public Expr
   bool hasElse = false; // to check if the node has else statement NEW
 
 public:
-  IfElse(ExprVector Exprs, Assign2DVector Assigns,bool hasElse) : Exprs(Exprs), Assigns(Assigns),hasElse(hasElse) {}
+  IfElse(ExprVector Exprs, Assign2DVector Assigns,bool hasElse) : Expr(AK_IfElse), Exprs(Exprs), Assigns(Assigns),hasElse(hasElse) {}
+
+  ~IfElse()
+  {
+    for (Expr *E : Exprs)
+      delete E;
+    for (auto &Arm : Assigns)
+      for (Assignment *A : Arm)
+        delete A;
+  }
 
   ExprVector::const_iterator beginExprs() { return Exprs.begin(); }
 
@@ -224,10 +325,20 @@ public:
 
   bool getHasElse() {return hasElse;};
 
+  // the conditions and assignments removed are not deleted
+  void setArms(ExprVector NewExprs, Assign2DVector NewAssigns, bool NewHasElse)
+  {
+    Exprs = NewExprs;
+    Assigns = NewAssigns;
+    hasElse = NewHasElse;
+  }
+
   virtual void accept(ASTVisitor &V) override
   {
     V.visit(*this);
   }
+
+  static bool classof(const AST *A) { return A->getASTKind() == AK_IfElse; }
 };
 
 // Loop class represents a loop in the AST
@@ -238,10 +349,19 @@ class Loop : public Expr
   Expr *E; // Expression
 
 public:
-  Loop(Expr *E, llvm::SmallVector<Assignment *> Assigns) : E(E), Assigns(Assigns) {}
+  Loop(Expr *E, llvm::SmallVector<Assignment *> Assigns) : Expr(AK_Loop), Assigns(Assigns), E(E) {}
+
+  ~Loop()
+  {
+    delete E;
+    for (Assignment *A : Assigns)
+      delete A;
+  }
 
   Expr *getCondition() { return E; }
 
+  void setCondition(Expr *C) { E = C; }
+
   AssignVector::const_iterator begin() { return Assigns.begin(); }
 
   AssignVector::const_iterator end() { return Assigns.end(); }
@@ -250,6 +370,44 @@ public:
   {
     V.visit(*this);
   }
+
+  static bool classof(const AST *A) { return A->getASTKind() == AK_Loop; }
+};
+
+// StaticASTVisitor dispatches on the node kind tag instead of virtual accept/visit
+// calls, so traversals can be inlined. Derived classes provide a visit overload for
+// every node type and call dispatch() on child nodes.
+template <typename Derived>
+class StaticASTVisitor
+{
+  Derived &derived() { return *static_cast<Derived *>(this); }
+
+public:
+  void dispatch(AST &Node)
+  {
+    switch (Node.getASTKind())
+    {
+    case AST::AK_AP:
+      return derived().visit(static_cast<AP &>(Node));
+    case AST::AK_Factor:
+      return derived().visit(static_cast<Factor &>(Node));
+    case AST::AK_BinaryOp:
+      // the only nodes nesting without bound
+      if (isStackNearlyExhausted())
+        return runOnNewStack([&] { derived().visit(static_cast<BinaryOp &>(Node)); });
+      return derived().visit(static_cast<BinaryOp &>(Node));
+    case AST::AK_Assignment:
+      return derived().visit(static_cast<Assignment &>(Node));
+    case AST::AK_Declaration:
+      return derived().visit(static_cast<Declaration &>(Node));
+    case AST::AK_IfElse:
+      return derived().visit(static_cast<IfElse &>(Node));
+    case AST::AK_Loop:
+      return derived().visit(static_cast<Loop &>(Node));
+    }
+  }
+
+  void dispatch(AST *Node) { dispatch(*Node); }
 };
 
 #endif
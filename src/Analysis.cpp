@@ -0,0 +1,625 @@
+#include "Analysis.h"
+#include "CodeGen.h"
+#include "Optimizer.h"
+#include "Parser.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+static cl::opt<bool>
+    EliminateDeadStores("eliminate-dead-stores",
+                        cl::desc("Remove assignments overwritten before their value is read"),
+                        cl::init(true));
+
+llvm::SmallVector<llvm::StringRef> allVars;
+StringMap<llvm::SmallVector<StringRef>> dependsMap;// a dictionarty type data structure, keys are variables and value are variables that are dependent to the key variable
+llvm::SmallVector<llvm::StringRef> deadVars;
+llvm::SmallVector<llvm::StringRef> alive;
+DenseMap<unsigned, StringRef> deadStores; // ids of assignments overwritten before use, with their variable
+
+namespace
+{
+  // override visit method for Declaration nodes to add all of the defined variables to allVars vector
+  class IdentifiersCollector : public StaticASTVisitor<IdentifiersCollector>
+  {
+    public:
+  
+    void visit(AP &Node)
+    {
+      // Iterate over the children of the AP node and visit each child.
+      for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
+      {
+        dispatch(*I);
+      }
+    };
+
+    void visit(Declaration &Node)
+    {
+      auto Vars_iterator = Node.beginVars();
+      for(Vars_iterator;Vars_iterator != Node.endVars();Vars_iterator++)
+      {
+        allVars.push_back(*Vars_iterator);
+      }
+    };
+
+    void visit(Assignment &) {}; 
+    void visit(BinaryOp &) {};
+    void visit(Factor &) {}; 
+    void visit(Loop &) {};
+    void visit(IfElse &) {}; 
+
+    void collect(AST *Tree)
+    {
+      dispatch(Tree);
+    }
+  };
+
+  // override visit method for Declaration, Factor and Assignment nodes to find each variables's dependents and assign thek to dependsMap
+  class ComputeDepends : public StaticASTVisitor<ComputeDepends>
+  {   
+    public:
+      llvm::SmallVector<llvm::StringRef> depends; // auxilary variable to store dependencies of variables throughout taversing process of AST
+
+      void visit(AP &Node)
+    {
+      // Iterate over the children of the AP node and visit each child.
+      for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
+      {
+        dispatch(*I);
+      }
+    };
+
+      void visit(Declaration &Node)
+      {
+        auto expression = Node.beginExprs();
+        auto var = Node.beginVars();
+        StringRef varName = *var;
+
+        if (expression != Node.endExprs())
+        {
+          dispatch(*expression);
+
+          llvm::SmallVector<llvm::StringRef> tempDepends(depends.begin(), depends.end());
+          // map[var] = depends
+          dependsMap[varName] = tempDepends;
+          depends.clear();
+        }
+        else
+        {
+          //do nothing since no dependency is found
+          // depends.clear();
+        }
+      };
+      
+      void visit(Factor &Node)
+      {
+        if (Node.getKind() == Factor::Ident)
+        {
+          // if is Ident add the var to depends
+
+          llvm::StringRef var = Node.getVal();
+
+          if (llvm::find(depends, var) == depends.end())
+          {
+            // If it's not in depends, add it
+            depends.push_back(var);
+          }
+        }
+      };
+
+      void visit(BinaryOp &Node)
+      {
+        dispatch(Node.getLeft());
+        dispatch(Node.getRight());
+      };
+
+      void visit(Assignment &Node) 
+      {
+        auto var = Node.getLeft()->getVal();
+        auto operation = Node.getOperator();
+        if(operation == Assignment::Eq)
+        {
+          dependsMap[var].clear();
+          dispatch(Node.getRight());
+
+          //map[var] = depends
+          dependsMap[var] = depends;
+          //depends.clear
+          depends.clear();
+        }
+        else// += -= etc
+        {
+          dispatch(Node.getRight());
+          appendDepends(dependsMap[var], depends);
+          depends.clear();
+
+        }
+      };
+
+      // assignments inside a loop or an if statement may or may not run, so they extend
+      // the dependencies of their variable with those of the right-hand side and of
+      // every condition controlling them
+      void addConditional(Assignment *Node, llvm::SmallVector<StringRef> &condDepends)
+      {
+        auto var = Node->getLeft()->getVal();
+        dispatch(Node->getRight());
+        appendDepends(dependsMap[var], depends);
+        appendDepends(dependsMap[var], condDepends);
+        depends.clear();
+      }
+
+      void visit(Loop &Node)
+      {
+        dispatch(Node.getCondition());
+        llvm::SmallVector<StringRef> condDepends(depends.begin(), depends.end());
+        depends.clear();
+
+        for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
+          addConditional(*I, condDepends);
+      };
+
+      void visit(IfElse &Node)
+      {
+        llvm::SmallVector<StringRef> condDepends;
+        auto assigns = Node.beginAssigns2D();
+        for (auto I = Node.beginExprs(), E = Node.endExprs(); I != E; ++I, ++assigns)
+        {
+          dispatch(*I);
+          condDepends.append(depends.begin(), depends.end());
+          depends.clear();
+          for (Assignment *A : *assigns)
+            addConditional(A, condDepends);
+        }
+        if (Node.getHasElse())
+          for (Assignment *A : *assigns)
+            addConditional(A, condDepends);
+      };
+
+    void compute(AST *Tree)
+      {
+        // Initialize dependsMap with keys from allVars
+        for (const auto &var : allVars)
+          {
+          dependsMap[var] = llvm::SmallVector<StringRef>();//HERE
+          }
+      dispatch(Tree);
+      }
+  };
+  // fused front end: performs the scope checks of Sema's InputCheck, the declaration
+  // collection of IdentifiersCollector and the dependency extraction of ComputeDepends
+  // in a single traversal of the AST
+  class FrontEndAnalysis : public StaticASTVisitor<FrontEndAnalysis>
+  {
+    llvm::StringSet<> Scope; // declared variables
+    llvm::SmallVector<llvm::StringRef> depends; // dependencies of the expression being traversed
+    bool Collecting = false; // whether visited identifiers are recorded in depends
+    bool HasError = false;
+
+    enum ErrorType { Twice, Not };
+
+    void error(ErrorType ET, llvm::StringRef V)
+    {
+      llvm::errs() << "Variable " << V << " is "
+                   << (ET == Twice ? "already" : "not")
+                   << " declared\n";
+      HasError = true;
+    }
+
+  public:
+    bool hasError() { return HasError; }
+
+    void visit(AP &Node)
+    {
+      for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
+      {
+        dispatch(*I);
+      }
+    };
+
+    void visit(Declaration &Node)
+    {
+      for (auto I = Node.beginVars(), E = Node.endVars(); I != E; ++I)
+      {
+        if (!Scope.insert(*I).second)
+          error(Twice, *I);
+        allVars.push_back(*I);
+        dependsMap[*I] = llvm::SmallVector<StringRef>();
+      }
+
+      // only the first initializer contributes dependencies, like ComputeDepends
+      bool first = true;
+      for (auto I = Node.beginExprs(), E = Node.endExprs(); I != E; ++I)
+      {
+        Collecting = first;
+        dispatch(*I);
+        if (first)
+        {
+          dependsMap[*Node.beginVars()] = depends;
+          depends.clear();
+        }
+        first = false;
+      }
+      Collecting = false;
+    };
+
+    void visit(Factor &Node)
+    {
+      if (Node.getKind() != Factor::Ident)
+        return;
+
+      llvm::StringRef var = Node.getVal();
+      if (Scope.find(var) == Scope.end())
+        error(Not, var);
+
+      if (Collecting && llvm::find(depends, var) == depends.end())
+        depends.push_back(var);
+    };
+
+    void visit(BinaryOp &Node)
+    {
+      if (Node.getLeft())
+        dispatch(Node.getLeft());
+      else
+        HasError = true;
+
+      auto right = Node.getRight();
+      if (right)
+        dispatch(right);
+      else
+        HasError = true;
+
+      if (Node.getOperator() == BinaryOp::Operator::Div && right)
+      {
+        Factor *f = llvm::dyn_cast<Factor>(right);
+        if (f && f->getKind() == Factor::ValueKind::Number)
+        {
+          int intval;
+          f->getVal().getAsInteger(10, intval);
+          if (intval == 0)
+          {
+            llvm::errs() << "Division by zero is not allowed." << "\n";
+            HasError = true;
+          }
+        }
+      }
+    };
+
+    void visit(Assignment &Node)
+    {
+      Factor *dest = Node.getLeft();
+
+      if (dest->getKind() == Factor::Number)
+      {
+        llvm::errs() << "Assignment destination must be an identifier.";
+        HasError = true;
+        return;
+      }
+
+      auto var = dest->getVal();
+      if (Scope.find(var) == Scope.end())
+        error(Not, var);
+
+      if (!Node.getRight())
+        return;
+
+      Collecting = true;
+      dispatch(Node.getRight());
+      Collecting = false;
+
+      if (Node.getOperator() == Assignment::Eq)
+        dependsMap[var] = depends;
+      else // += -= etc
+        appendDepends(dependsMap[var], depends);
+      depends.clear();
+    };
+
+    // same dependency rules as ComputeDepends::addConditional
+    void addConditional(Assignment *Node, llvm::SmallVector<StringRef> &condDepends)
+    {
+      auto var = Node->getLeft()->getVal();
+      if (Scope.find(var) == Scope.end())
+        error(Not, var);
+
+      Collecting = true;
+      dispatch(Node->getRight());
+      Collecting = false;
+
+      appendDepends(dependsMap[var], depends);
+      appendDepends(dependsMap[var], condDepends);
+      depends.clear();
+    }
+
+    void visit(Loop &Node)
+    {
+      Collecting = true;
+      dispatch(Node.getCondition());
+      Collecting = false;
+      llvm::SmallVector<StringRef> condDepends(depends.begin(), depends.end());
+      depends.clear();
+
+      for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
+        addConditional(*I, condDepends);
+    };
+
+    void visit(IfElse &Node)
+    {
+      llvm::SmallVector<StringRef> condDepends;
+      auto assigns = Node.beginAssigns2D();
+      for (auto I = Node.beginExprs(), E = Node.endExprs(); I != E; ++I, ++assigns)
+      {
+        Collecting = true;
+        dispatch(*I);
+        Collecting = false;
+        condDepends.append(depends.begin(), depends.end());
+        depends.clear();
+        for (Assignment *A : *assigns)
+          addConditional(A, condDepends);
+      }
+      if (Node.getHasElse())
+        for (Assignment *A : *assigns)
+          addConditional(A, condDepends);
+    };
+
+    void analyze(AST *Tree)
+    {
+      dispatch(Tree);
+    }
+  };
+
+  // finds assignments whose value is overwritten before it is read. The program is
+  // scanned forward, so it can also run one statement at a time in streaming mode.
+  // Assignments inside if arms and loop bodies are checked against the other
+  // assignments of the same block only, since they may not run.
+  class DeadStoreAnalysis : public StaticASTVisitor<DeadStoreAnalysis>
+  {
+    StringMap<unsigned> Pending; // last assignment to each variable whose value is not read yet
+
+    // the reads of a block count as reads for the enclosing code, then the block is
+    // analyzed on its own
+    void visitBlock(llvm::ArrayRef<Assignment *> Assigns)
+    {
+      for (Assignment *A : Assigns)
+      {
+        dispatch(A->getRight());
+        if (A->getOperator() != Assignment::Eq)
+          Pending.erase(A->getLeft()->getVal());
+      }
+
+      StringMap<unsigned> Outer;
+      std::swap(Outer, Pending);
+      for (Assignment *A : Assigns)
+        dispatch(A);
+      std::swap(Outer, Pending);
+    }
+
+  public:
+    void visit(AP &Node)
+    {
+      for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
+        dispatch(*I);
+    };
+
+    void visit(Factor &Node)
+    {
+      if (Node.getKind() == Factor::Ident)
+        Pending.erase(Node.getVal());
+    };
+
+    void visit(BinaryOp &Node)
+    {
+      dispatch(Node.getLeft());
+      dispatch(Node.getRight());
+    };
+
+    void visit(Declaration &Node)
+    {
+      for (auto I = Node.beginExprs(), E = Node.endExprs(); I != E; ++I)
+        dispatch(*I);
+      for (auto I = Node.beginVars(), E = Node.endVars(); I != E; ++I)
+        Pending.erase(*I);
+    };
+
+    void visit(Assignment &Node)
+    {
+      dispatch(Node.getRight());
+
+      auto var = Node.getLeft()->getVal();
+      if (Node.getOperator() != Assignment::Eq)
+        Pending.erase(var);
+
+      auto Previous = Pending.find(var);
+      if (Previous != Pending.end())
+        deadStores[Previous->getValue()] = var;
+
+      if (Node.getId())
+        Pending[var] = Node.getId();
+      else
+        Pending.erase(var);
+    };
+
+    void visit(IfElse &Node)
+    {
+      for (auto I = Node.beginExprs(), E = Node.endExprs(); I != E; ++I)
+        dispatch(*I);
+      for (auto I = Node.beginAssigns2D(), E = Node.endAssigns2D(); I != E; ++I)
+        visitBlock(*I);
+    };
+
+    void visit(Loop &Node)
+    {
+      dispatch(Node.getCondition());
+      visitBlock(llvm::SmallVector<Assignment *>(Node.begin(), Node.end()));
+    };
+  };
+}
+
+// defined with the analysis, which every binary using a CodeGen links
+CodeGen::CodeGen() = default;
+CodeGen::~CodeGen() = default;
+
+void CodeGen::collectIdentifiers(AST *Tree)
+{
+  IdentifiersCollector IdentifierCollector;
+  IdentifierCollector.collect(Tree);
+}
+
+void CodeGen::computeDepends(AST *Tree){
+  ComputeDepends computeDepends;
+  computeDepends.compute(Tree);
+  
+}
+
+bool CodeGen::analyze(AST *Tree)
+{
+  FrontEndAnalysis Analysis;
+  Analysis.analyze(Tree);
+  if (EliminateDeadStores)
+  {
+    DeadStoreAnalysis DeadStores;
+    DeadStores.dispatch(Tree);
+  }
+  return Analysis.hasError();
+}
+
+// rerun the separate IdentifiersCollector and ComputeDepends passes and compare
+// their results with the ones produced by the fused analysis
+bool CodeGen::verifyAnalysis(AST *Tree)
+{
+  llvm::SmallVector<llvm::StringRef> fusedVars(allVars.begin(), allVars.end());
+  StringMap<llvm::SmallVector<StringRef>> fusedDepends(dependsMap);
+
+  allVars.clear();
+  dependsMap.clear();
+  collectIdentifiers(Tree);
+  computeDepends(Tree);
+
+  bool mismatch = fusedVars != allVars || fusedDepends.size() != dependsMap.size();
+  for (const auto &entry : dependsMap)
+  {
+    auto fused = fusedDepends.find(entry.getKey());
+    if (fused == fusedDepends.end() || fused->getValue() != entry.getValue())
+    {
+      llvm::errs() << "analysis mismatch for variable '" << entry.getKey() << "'\n";
+      mismatch = true;
+    }
+  }
+  return mismatch;
+}
+
+// initialize deadVars, reporting them unless Report is false
+void CodeGen::computeDead(bool Report)
+{
+  void addDependenciesRecursive(const llvm::StringRef &variable, llvm::SmallVector<llvm::StringRef> &alive);
+
+  llvm::SmallVector<llvm::StringRef> resultDepends = dependsMap["result"];//error prone
+  for(const auto &variable : resultDepends)
+  {
+    addDependenciesRecursive(variable, alive);
+  }
+
+  for(const auto &variable : allVars)
+  {
+    // Check if var is not in alive
+    if (llvm::find(alive,variable ) == alive.end()) 
+    {
+        // Add var to deadVars
+        if(variable != "result")
+        {
+          deadVars.push_back(variable);
+        }
+    }
+  }
+  if (!Report)
+    return;
+  for (const auto &var : deadVars)
+  {
+    llvm::outs() << "variable '" << var << "' is dead." << "\n";
+  }
+
+  // stores to dead variables disappear with them, only count the others
+  unsigned removedStores = 0;
+  for (const auto &store : deadStores)
+  {
+    if (llvm::find(deadVars, store.second) == deadVars.end())
+      ++removedStores;
+  }
+  if (removedStores)
+  {
+    llvm::outs() << removedStores << " dead store(s) removed." << "\n";
+  }
+
+}
+
+//auxiliary function to perfrom the recursive algorithm that finds variables that "result" variable is dependent on them
+void addDependenciesRecursive(const llvm::StringRef &variable, llvm::SmallVector<llvm::StringRef> &alive) {
+    // Check if the variable is already in the 'alive' vector to avoid duplicates
+    if (llvm::find(alive, variable) == alive.end()) {
+        // Add the variable to 'alive'
+        alive.push_back(variable);
+
+        // Recursively add dependencies
+        const auto &dependencies = dependsMap[variable];
+        for (const auto &dependency : dependencies) {
+            addDependenciesRecursive(dependency, alive);
+        }
+    }
+}
+
+// pass 1 of streaming mode: analyze the program one statement at a time, keeping
+// only the declared variables and their dependency lists
+bool CodeGen::analyzeStreaming(Parser &P)
+{
+  FrontEndAnalysis Analysis;
+  DeadStoreAnalysis DeadStores;
+  while (Expr *Statement = P.parseNext())
+  {
+    // after a syntax error the statements are only parsed, to report the other
+    // errors: recovery may have left operands of a statement missing
+    if (!P.hasError())
+    {
+      Analysis.dispatch(Statement);
+      if (EliminateDeadStores)
+        DeadStores.dispatch(Statement);
+    }
+    delete Statement;
+  }
+  return Analysis.hasError();
+}
+
+// the results of the analysis as one JSON object: the declared variables, the live
+// and dead ones, and for every variable the variables its value depends on
+void CodeGen::writeAnalysis(raw_ostream &OS)
+{
+  json::OStream J(OS, 2);
+  J.object([&] {
+    J.attributeArray("variables", [&] {
+      for (StringRef Var : allVars)
+        J.value(Var);
+    });
+    J.attributeArray("live", [&] {
+      for (StringRef Var : allVars)
+        if (llvm::find(deadVars, Var) == deadVars.end())
+          J.value(Var);
+    });
+    J.attributeArray("dead", [&] {
+      for (StringRef Var : deadVars)
+        J.value(Var);
+    });
+    J.attributeObject("dependencies", [&] {
+      for (StringRef Var : allVars)
+        J.attributeArray(Var, [&] {
+          for (StringRef Dep : dependsMap[Var])
+            J.value(Dep);
+        });
+    });
+    unsigned removedStores = 0;
+    for (const auto &store : deadStores)
+      if (llvm::find(deadVars, store.second) == deadVars.end())
+        ++removedStores;
+    J.attribute("deadStores", removedStores);
+  });
+  OS << "\n";
+}
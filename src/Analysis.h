@@ -0,0 +1,29 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+// Results of the front-end analysis and of CodeGen::computeDead, shared with code
+// generation. The analysis only needs LLVM's Support library.
+extern llvm::SmallVector<llvm::StringRef> allVars;
+extern llvm::StringMap<llvm::SmallVector<llvm::StringRef>> dependsMap;
+extern llvm::SmallVector<llvm::StringRef> deadVars;
+extern llvm::SmallVector<llvm::StringRef> alive;
+extern llvm::DenseMap<unsigned, llvm::StringRef> deadStores;
+
+// add the variables of From missing in To, so dependency lists stay bounded by the
+// number of variables however often a variable is updated
+inline void appendDepends(llvm::SmallVector<llvm::StringRef> &To,
+                          llvm::ArrayRef<llvm::StringRef> From)
+{
+  for (llvm::StringRef var : From)
+    if (llvm::find(To, var) == To.end())
+      To.push_back(var);
+}
+
+#endif
@@ -0,0 +1,204 @@
+#include "Backend.h"
+#include "llvm/ADT/ScopeExit.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+#include "llvm/Transforms/InstCombine/InstCombine.h"
+#include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/Utils.h"
+#include "llvm/Transforms/Utils/SplitModule.h"
+#include <atomic>
+#include <vector>
+
+using namespace llvm;
+
+namespace
+{
+  // a target machine for the host, or nullptr after a diagnostic; a TargetMachine
+  // must not be shared between threads
+  std::unique_ptr<TargetMachine> createTargetMachine()
+  {
+    std::string Triple = sys::getProcessTriple();
+    std::string Error;
+    const Target *T = TargetRegistry::lookupTarget(Triple, Error);
+    if (!T)
+    {
+      errs() << "No target for " << Triple << ": " << Error << "\n";
+      return nullptr;
+    }
+    // position independent, so the object links into gcc's default executables
+    return std::unique_ptr<TargetMachine>(
+        T->createTargetMachine(Triple, "generic", "", TargetOptions(), Reloc::PIC_));
+  }
+
+  bool compile(Module &M, TargetMachine &TM, raw_pwrite_stream &OS)
+  {
+    optimizeForCodeGen(M);
+    legacy::PassManager PM;
+    if (TM.addPassesToEmitFile(PM, OS, nullptr, CGFT_ObjectFile))
+    {
+      errs() << "The target cannot emit object files\n";
+      return false;
+    }
+    PM.run(M);
+    return true;
+  }
+
+  // link the objects into one relocatable object, written to OS
+  bool link(ArrayRef<SmallString<0>> Objects, raw_ostream &OS)
+  {
+    NamedRegionTimer T("link", "Object linking", "ap", "AP compiler phases",
+                       TimePassesIsEnabled);
+    ErrorOr<std::string> LD = sys::findProgramByName("ld");
+    if (!LD)
+    {
+      errs() << "Cannot find ld to link the objects: " << LD.getError().message() << "\n";
+      return false;
+    }
+
+    SmallVector<SmallString<128>, 16> Files;
+    auto RemoveFiles = make_scope_exit([&] {
+      for (SmallString<128> &File : Files)
+        sys::fs::remove(File);
+    });
+
+    SmallString<128> Output;
+    if (std::error_code EC = sys::fs::createTemporaryFile("ap", "o", Output))
+    {
+      errs() << "Cannot create a temporary file: " << EC.message() << "\n";
+      return false;
+    }
+    Files.push_back(Output);
+    SmallVector<StringRef, 20> Args = {"ld", "-r", "-o", Output};
+
+    for (const SmallString<0> &Object : Objects)
+    {
+      int FD;
+      SmallString<128> Path;
+      if (std::error_code EC = sys::fs::createTemporaryFile("ap-part", "o", FD, Path))
+      {
+        errs() << "Cannot create a temporary file: " << EC.message() << "\n";
+        return false;
+      }
+      Files.push_back(Path);
+      raw_fd_ostream File(FD, /*shouldClose=*/true);
+      File << Object;
+      File.close();
+      if (File.has_error())
+      {
+        errs() << "Cannot write " << Path << ": " << File.error().message() << "\n";
+        File.clear_error();
+        return false;
+      }
+    }
+    for (size_t I = 1; I < Files.size(); ++I)
+      Args.push_back(Files[I]);
+
+    std::string ErrMsg;
+    if (sys::ExecuteAndWait(*LD, Args, None, {}, 0, 0, &ErrMsg))
+    {
+      errs() << "Cannot link the objects" << (ErrMsg.empty() ? "" : ": ") << ErrMsg << "\n";
+      return false;
+    }
+
+    ErrorOr<std::unique_ptr<MemoryBuffer>> Linked = MemoryBuffer::getFile(Output);
+    if (!Linked)
+    {
+      errs() << "Cannot read " << Output << ": " << Linked.getError().message() << "\n";
+      return false;
+    }
+    OS << (*Linked)->getBuffer();
+    return true;
+  }
+}
+
+void optimizeForCodeGen(Module &M)
+{
+  legacy::FunctionPassManager FPM(&M);
+  FPM.add(createPromoteMemoryToRegisterPass());
+  FPM.add(createInstructionCombiningPass());
+  FPM.add(createCFGSimplificationPass());
+  FPM.add(createEarlyCSEPass());
+  FPM.add(createLICMPass());
+  FPM.add(createInstructionCombiningPass());
+  FPM.doInitialization();
+  for (Function &F : M)
+    FPM.run(F);
+  FPM.doFinalization();
+}
+
+bool emitObject(Module &M, raw_pwrite_stream &OS, unsigned Threads)
+{
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+
+  std::unique_ptr<TargetMachine> TM = createTargetMachine();
+  if (!TM)
+    return false;
+  M.setDataLayout(TM->createDataLayout());
+  M.setTargetTriple(TM->getTargetTriple().str());
+
+  if (!Threads)
+    Threads = hardware_concurrency().compute_thread_count();
+  if (Threads == 1)
+  {
+    NamedRegionTimer T("backend", "Native code generation", "ap", "AP compiler phases",
+                       TimePassesIsEnabled);
+    return compile(M, *TM, OS);
+  }
+
+  // a context must only be used by one thread at a time, so every part moves to a
+  // context of its own as bitcode
+  std::vector<SmallString<0>> Parts;
+  {
+    NamedRegionTimer T("split", "Module splitting", "ap", "AP compiler phases",
+                       TimePassesIsEnabled);
+    SplitModule(M, Threads, [&](std::unique_ptr<Module> Part) {
+      Parts.emplace_back();
+      raw_svector_ostream BOS(Parts.back());
+      WriteBitcodeToFile(*Part, BOS);
+    });
+  }
+
+  std::vector<SmallString<0>> Objects(Parts.size());
+  std::atomic<bool> Failed(false);
+  {
+    NamedRegionTimer T("backend", "Native code generation", "ap", "AP compiler phases",
+                       TimePassesIsEnabled);
+    ThreadPool Pool(hardware_concurrency(Threads));
+    for (size_t I = 0; I < Parts.size(); ++I)
+      Pool.async([&, I] {
+        LLVMContext Ctx;
+        Expected<std::unique_ptr<Module>> Part =
+            parseBitcodeFile(MemoryBufferRef(Parts[I], "ap.part"), Ctx);
+        if (!Part)
+        {
+          errs() << "Cannot read a part of the module: " << toString(Part.takeError()) << "\n";
+          Failed = true;
+          return;
+        }
+        std::unique_ptr<TargetMachine> PartTM = createTargetMachine();
+        raw_svector_ostream OOS(Objects[I]);
+        if (!PartTM || !compile(**Part, *PartTM, OOS))
+          Failed = true;
+      });
+    Pool.wait();
+  }
+  return !Failed && link(Objects, OS);
+}
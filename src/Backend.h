@@ -0,0 +1,22 @@
+#ifndef BACKEND_H
+#define BACKEND_H
+
+namespace llvm
+{
+  class Module;
+  class raw_pwrite_stream;
+}
+
+// the scalar cleanups compiled code needs before code generation, built from legacy
+// passes: the new pass manager's pipelines would link LLVM's loop unroller, whose
+// options clash with ours
+void optimizeForCodeGen(llvm::Module &M);
+
+// Write M as an object file for the host to OS, after optimizeForCodeGen. With more
+// than one thread, M is split with SplitModule and every part is optimized and
+// compiled on a thread of its own, in a context of its own and with a TargetMachine
+// of its own; the objects of the parts are then linked into one relocatable object
+// with "ld -r". Returns false after a diagnostic.
+bool emitObject(llvm::Module &M, llvm::raw_pwrite_stream &OS, unsigned Threads);
+
+#endif
@@ -1,7 +1,26 @@
 #include "CodeGen.h"
+#include "Analysis.h"
+#include "Backend.h"
+#include "Interpreter.h"
+#include "JIT.h"
+#include "LoopAnalysis.h"
+#include "Optimizer.h"
+#include "Parser.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Timer.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringRef.h"
@@ -10,146 +29,150 @@
 
 using namespace llvm;
 
-llvm::SmallVector<llvm::StringRef> allVars;
-StringMap<llvm::SmallVector<StringRef>> dependsMap;// a dictionarty type data structure, keys are variables and value are variables that are dependent to the key variable
-llvm::SmallVector<llvm::StringRef> deadVars;
-llvm::SmallVector<llvm::StringRef> alive;
+// Fully unroll a loopc with a constant trip count when trip count * body size stays
+// within this many assignments; otherwise unroll by the largest factor of 8, 4 or 2
+// dividing the trip count that does.
+static cl::opt<unsigned>
+    UnrollThreshold("unroll-threshold",
+                    cl::desc("Maximum number of assignments emitted by loop unrolling (0 disables unrolling)"),
+                    cl::init(64));
+
+// Structurally identical expressions get the same hash-consing key, and ToIRVisitor
+// reuses the value of a key already computed in the current basic block.
+static cl::opt<bool>
+    EnableCSE("cse",
+              cl::desc("Emit each distinct expression value once per basic block"),
+              cl::init(true));
+
+// "and"/"or" conditions whose right-hand side costs more than this many instructions
+// are lowered with short-circuit branches instead of a bitwise and/or.
+static cl::opt<unsigned>
+    ShortCircuitThreshold("short-circuit-threshold",
+                          cl::desc("Maximum cost of the right-hand side of a branchless and/or condition"),
+                          cl::init(4));
+
+// if/elif chains comparing one variable against this many literals or more are
+// lowered to a switch instruction.
+static cl::opt<unsigned>
+    SwitchMinArms("switch-min-arms",
+                  cl::desc("Minimum number of 'x == constant' arms lowered to a switch (0 disables)"),
+                  cl::init(3));
+
+// if/elif/else statements whose arms each assign the same variable once are
+// evaluated branch-free with selects when their total cost stays within this.
+static cl::opt<unsigned>
+    SelectThreshold("select-threshold",
+                    cl::desc("Maximum cost of an if statement converted to selects (0 disables)"),
+                    cl::init(16));
+
+static cl::opt<bool>
+    StrengthReduce("strength-reduce",
+                   cl::desc("Rewrite multiplications, divisions and modulos by constants into shifts, masks and multiply-high"),
+                   cl::init(true));
+
+// Variables whose values are known at compile time are replaced by literals, and if
+// arms and loops that can never run are removed, before IR is generated.
+static cl::opt<bool>
+    PropagateConstants("propagate-constants",
+                       cl::desc("Fold variables with values known at compile time and remove the if arms and loops that never run"),
+                       cl::init(true));
+
+// A loopc whose variables follow polynomial recurrences in the iteration number is
+// replaced by the values of its variables after the last iteration. Only those final
+// values are reported, not the value of every assignment in every iteration, so
+// the optimization changes the program's output and has to be asked for.
+static cl::opt<bool>
+    ClosedFormLoops("closed-form-loops",
+                    cl::desc("Compute the result of polynomial accumulator loops without iterating, reporting only the final values"),
+                    cl::init(false));
+
+// Every if statement gets a counter for its entry and one per arm, every loopc one
+// for its entry and one for its body. The runtime writes the counts to the file
+// named by AP_PROFILE_FILE (ap.prof by default) when the program exits.
+static cl::opt<bool>
+    Instrument("instrument",
+               cl::desc("Count how often every if arm and loop body runs"),
+               cl::init(false));
+
+static cl::opt<std::string>
+    ProfileUse("profile-use",
+               cl::desc("Attach branch weights from the profile in <file>"),
+               cl::value_desc("file"),
+               cl::init(""));
+
+// External variables are read from the program input, a file named by AP_INPUT_FILE
+// or stdin, all at once when the program starts. Their initializers are ignored.
+static cl::list<std::string>
+    ExternVars("extern-vars",
+               cl::desc("Variables whose initial values are read from the input, in this order"),
+               cl::value_desc("var,..."),
+               cl::CommaSeparated);
+
+// main calls one function per chunk of top-level statements, so passes scaling
+// super-linearly with function size see chunks instead of the whole program. The
+// variables live in a state array allocated by main, which every chunk copies in
+// and out of its own stack slots.
+static cl::opt<unsigned>
+    ChunkSize("chunk-size",
+              cl::desc("Emit every <n> top-level statements as a separate function called by main (0 = one function)"),
+              cl::value_desc("n"),
+              cl::init(0));
+
+// The batch function runs the program once per input tuple: tuple j takes column k
+// of the input as the initial value of the k-th external variable and produces the
+// final value of result. The generated main hands it to the runtime's ap_run_batch,
+// which maps a columnar input file and prints the results.
+static cl::opt<bool>
+    Batch("batch",
+          cl::desc("Emit ap_batch, evaluating the program over arrays of inputs without branching on if statements"),
+          cl::init(false));
+
+// -tiered interprets the program and compiles a loop to native code once it has
+// taken this many back edges; the compiled code runs the remaining iterations.
+static cl::opt<unsigned>
+    TierThreshold("tier-threshold",
+                  cl::desc("Number of back edges after which -tiered compiles a loop (0 never compiles)"),
+                  cl::init(1000));
+
+static cl::opt<std::string>
+    OutputFilename("o",
+                   cl::desc("Write the module to <file> instead of stdout"),
+                   cl::value_desc("file"),
+                   cl::init("-"));
+
+static cl::opt<bool>
+    EmitBitcode("emit-bc",
+                cl::desc("Write the module as LLVM bitcode instead of textual IR"),
+                cl::init(false));
+
+// The object runs like the executable of the IR written otherwise: link it with
+// rtAP.c.
+static cl::opt<bool>
+    EmitObject("emit-obj",
+               cl::desc("Write the program as a native object file for the host instead of IR"),
+               cl::init(false));
+
+// -emit-obj splits the module into this many parts and generates their code in
+// parallel; the program needs to be cut into functions with -chunk-size for the
+// parts to share the work.
+static cl::opt<unsigned>
+    Jobs("j",
+         cl::desc("Number of threads generating native code (0 = one per core)"),
+         cl::value_desc("n"),
+         cl::init(1));
+
+// Building the module without writing it is useful when it is only consumed
+// in-process, and for measuring code generation alone.
+static cl::opt<bool>
+    NoOutput("no-output",
+             cl::desc("Do not write the generated module"),
+             cl::init(false));
 
 // Define a visitor class for generating LLVM IR from the AST.
 namespace
 {
-  // override visit method for Declaration nodes to add all of the defined variables to allVars vector
-  class IdentifiersCollector : public ASTVisitor
-  {
-    public:
-  
-    virtual void visit(AP &Node) override
-    {
-      // Iterate over the children of the AP node and visit each child.
-      for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
-      {
-        (*I)->accept(*this);
-      }
-    };
-
-    virtual void visit(Declaration &Node) override
-    {
-      auto Vars_iterator = Node.beginVars();
-      for(Vars_iterator;Vars_iterator != Node.endVars();Vars_iterator++)
-      {
-        allVars.push_back(*Vars_iterator);
-      }
-    };
-
-    virtual void visit(Assignment &) override {}; 
-    virtual void visit(BinaryOp &) override {};
-    virtual void visit(Factor &) override {}; 
-    virtual void visit(Loop &) override {};
-    virtual void visit(IfElse &) override {}; 
-
-    void collect(AST *Tree)
-    {
-      Tree->accept(*this);
-    }
-  };
-
-  // override visit method for Declaration, Factor and Assignment nodes to find each variables's dependents and assign thek to dependsMap
-  class ComputeDepends : public ASTVisitor
-  {   
-    public:
-      llvm::SmallVector<llvm::StringRef> depends; // auxilary variable to store dependencies of variables throughout taversing process of AST
-
-      virtual void visit(AP &Node) override
-    {
-      // Iterate over the children of the AP node and visit each child.
-      for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
-      {
-        (*I)->accept(*this);
-      }
-    };
-
-      virtual void visit(Declaration &Node) override
-      {
-        auto expression = Node.beginExprs();
-        auto var = Node.beginVars();
-        StringRef varName = *var;
-
-        if (expression != Node.endExprs())
-        {
-          (*expression)->accept(*this);
-
-          llvm::SmallVector<llvm::StringRef> tempDepends(depends.begin(), depends.end());
-          // map[var] = depends
-          dependsMap[varName] = tempDepends;
-          depends.clear();
-        }
-        else
-        {
-          //do nothing since no dependency is found
-          // depends.clear();
-        }
-      };
-      
-      virtual void visit(Factor &Node) override
-      {
-        if (Node.getKind() == Factor::Ident)
-        {
-          // if is Ident add the var to depends
-
-          llvm::StringRef var = Node.getVal();
-
-          if (llvm::find(depends, var) == depends.end())
-          {
-            // If it's not in depends, add it
-            depends.push_back(var);
-          }
-        }
-      };
-
-      virtual void visit(BinaryOp &Node) override
-      {
-        Node.getLeft()->accept(*this);
-        Node.getRight()->accept(*this);
-      };
-
-      virtual void visit(Assignment &Node) override 
-      {
-        auto var = Node.getLeft()->getVal();
-        auto operation = Node.getOperator();
-        if(operation == Assignment::Eq)
-        {
-          dependsMap[var].clear();
-          Node.getRight()->accept(*this);
-
-          //map[var] = depends
-          dependsMap[var] = depends;
-          //depends.clear
-          depends.clear();
-        }
-        else// += -= etc
-        {
-          Node.getRight()->accept(*this);
-          dependsMap[var].insert(dependsMap[var].end(), depends.begin(), depends.end());
-          depends.clear();
-
-        }
-      };
-
-      virtual void visit(Loop &) override {};
-      virtual void visit(IfElse &) override {};
-
-    void compute(AST *Tree)
-      {
-        // Initialize dependsMap with keys from allVars
-        for (const auto &var : allVars)
-          {
-          dependsMap[var] = llvm::SmallVector<StringRef>();//HERE
-          }
-      Tree->accept(*this);
-      }
-  };
   // override visit method to generate low level code with llvm (final step)
-  class ToIRVisitor : public ASTVisitor
+  class ToIRVisitor : public StaticASTVisitor<ToIRVisitor>
   {
     Module *M;// easy IR generation
     IRBuilder<> Builder;
@@ -163,6 +186,60 @@ namespace
     StringMap<AllocaInst *> nameMap;// maps a variable name to the value that's returned by calc_read()
     FunctionType *CalcWriteFnTy;
     Function *CalcWriteFn;
+    StringMap<int64_t> Known; // constant values stored by straight-line code
+    unsigned Nesting = 0; // number of enclosing if/loop statements
+    bool InCondition = false; // whether the expression being visited decides a branch
+    DenseMap<BinaryOp *, std::pair<Value *, unsigned>> Hoisted; // loop-invariant expressions evaluated before the loop, with their keys
+
+    // Hash-consing of expressions: a variable, a literal or an (operator, left key,
+    // right key) triple is interned to a key shared by all structurally identical
+    // expressions.
+    StringMap<unsigned> IdentKeys;
+    DenseMap<int64_t, unsigned> NumberKeys;
+    DenseMap<std::tuple<unsigned, unsigned, unsigned>, unsigned> OpKeys;
+    DenseMap<unsigned, SmallVector<StringRef>> KeyReads; // variables read by the expression of each key
+    unsigned NextKey = 0;
+    unsigned Key; // key of the expression visited last, alongside V
+
+    // Values available in the current basic block, by key. Storing to a variable
+    // drops the values that read it.
+    DenseMap<unsigned, Value *> Available;
+    StringMap<SmallVector<unsigned>> KeyUsers; // available keys reading each variable
+    BasicBlock *AvailableBB = nullptr;
+
+    // Profiling counters are numbered in program order, so an instrumented build and
+    // a build using its profile agree on them.
+    unsigned NextCounter = 0;
+    SmallVector<GlobalVariable *> Counters; // with -instrument
+    std::vector<uint64_t> Profile;          // with -profile-use
+
+    Value *Inputs = nullptr; // values of the external variables, read by the runtime
+
+    // with -batch: the input columns, the index of the current tuple and the blocks
+    // of the tuple loop
+    SmallVector<Value *> Columns;
+    PHINode *Tuple = nullptr;
+    BasicBlock *TupleBB = nullptr;
+    BasicBlock *TupleExitBB = nullptr;
+
+    bool Tiered = false; // emitting a single loop for the tiered interpreter
+
+    // with -chunk-size: MainFn is the current chunk, main calls the chunks in order
+    // at the end of MainCallsBB and keeps the variables in its State array, at the
+    // index of each variable in StateIndex. The slots in nameMap belong to the
+    // current chunk.
+    Function *Main = nullptr;
+    BasicBlock *MainCallsBB = nullptr;
+    AllocaInst *State = nullptr;
+    Value *MainInputs = nullptr;
+    StringMap<unsigned> StateIndex;
+    unsigned StatementsInChunk = 0;
+    unsigned NextChunk = 0;
+
+    // polynomial in the iteration number k, as the coefficients of the binomials
+    // C(k, 0), C(k, 1), ...; all arithmetic wraps around like i32
+    using Poly = SmallVector<Value *, 4>;
+    DenseMap<unsigned, Poly> StartPolys; // value at the start of iteration k, by body position
 
     //llvm::SmallVector<llvm::StringRef> allVars;
 
@@ -181,36 +258,223 @@ namespace
     // Entry point for generating LLVM IR from the AST.
     void run(AST *Tree)
     {
-      // Create the main function with the appropriate function type.
-      FunctionType *MainFty = FunctionType::get(Int32Ty, {Int32Ty, Int8PtrPtrTy}, false);
-      MainFn = Function::Create(MainFty, GlobalValue::ExternalLinkage, "main", M);
-
-      // Create a basic block for the entry point of the main function.
-      BasicBlock *BB = BasicBlock::Create(M->getContext(), "entry", MainFn);
-      Builder.SetInsertPoint(BB);
+      begin();
 
       // Visit the root node of the AST to generate IR.
       // begin the AST traversal 
-      Tree->accept(*this);
+      dispatch(Tree);
+
+      finish();
+    }
+
+    // Create the main function and position the builder at its entry block.
+    void begin()
+    {
+      if (Batch)
+        beginBatch();
+      else
+      {
+        // Create the main function with the appropriate function type.
+        FunctionType *MainFty = FunctionType::get(Int32Ty, {Int32Ty, Int8PtrPtrTy}, false);
+        MainFn = Function::Create(MainFty, GlobalValue::ExternalLinkage, "main", M);
+
+        // Create a basic block for the entry point of the main function.
+        BasicBlock *BB = BasicBlock::Create(M->getContext(), "entry", MainFn);
+        Builder.SetInsertPoint(BB);
+      }
+      if (Batch && ChunkSize)
+        errs() << "warning: -chunk-size is ignored with -batch\n";
+
+      // Every assignment reports its value through the runtime's ap_write.
+      CalcWriteFnTy = FunctionType::get(VoidTy, {Int32Ty}, false);
+      CalcWriteFn = Function::Create(CalcWriteFnTy, GlobalValue::ExternalLinkage, "ap_write", M);
+
+      if (!ProfileUse.empty())
+        loadProfile();
+
+      if (Batch && Instrument)
+        errs() << "warning: -instrument is ignored with -batch\n";
+
+      if (!ExternVars.empty())
+      {
+        for (const std::string &Var : ExternVars)
+          if (llvm::find(allVars, Var) == allVars.end())
+            errs() << "warning: external variable '" << Var << "' is not declared\n";
+        // the batch function reads them from its input columns instead
+        if (!Batch)
+        {
+          FunctionCallee ReadInputs = M->getOrInsertFunction("ap_read_inputs", Int32Ty->getPointerTo(), Int32Ty);
+          Inputs = Builder.CreateCall(ReadInputs, {Builder.getInt32(ExternVars.size())});
+        }
+      }
+
+      if (isChunked())
+      {
+        Main = MainFn;
+        MainInputs = Inputs;
+        // the number of variables is known once the last chunk is done
+        State = Builder.CreateAlloca(Int32Ty, Builder.getInt32(1), "state");
+        MainCallsBB = Builder.GetInsertBlock();
+        beginChunk();
+      }
+    }
+
+    bool isChunked() { return ChunkSize && !Batch && !Tiered; }
+
+    // internal void ap.chunk.N(i32 *noalias State, i32 *Inputs), kept out of main
+    void beginChunk()
+    {
+      Type *Int32PtrTy = Int32Ty->getPointerTo();
+      FunctionType *ChunkTy = FunctionType::get(VoidTy, {Int32PtrTy, Int32PtrTy}, false);
+      MainFn = Function::Create(ChunkTy, GlobalValue::InternalLinkage, "ap.chunk." + Twine(NextChunk++), M);
+      MainFn->addParamAttr(0, Attribute::NoAlias);
+      MainFn->addFnAttr(Attribute::NoInline);
+      Builder.SetInsertPoint(BasicBlock::Create(M->getContext(), "entry", MainFn));
+      Inputs = MainFn->getArg(1);
+      nameMap.clear();
+      StatementsInChunk = 0;
+    }
+
+    // copy the variables the chunk used back to the state and call it from main
+    void endChunk()
+    {
+      for (const auto &Slot : nameMap)
+      {
+        auto I = StateIndex.find(Slot.getKey());
+        if (Slot.getValue() && I != StateIndex.end())
+          Builder.CreateStore(Builder.CreateLoad(Int32Ty, Slot.getValue()),
+                              Builder.CreateConstInBoundsGEP1_32(Int32Ty, MainFn->getArg(0), I->getValue()));
+      }
+      Builder.CreateRetVoid();
 
-      // Create a return instruction at the end of the main function.
-      Builder.CreateRet(Int32Zero);
+      IRBuilder<> MainBuilder(MainCallsBB);
+      MainBuilder.CreateCall(MainFn, {State, MainInputs ? MainInputs : ConstantPointerNull::get(Int32Ty->getPointerTo())});
+    }
+
+    // called before every top-level statement, starts a new chunk every ChunkSize
+    void beginStatement()
+    {
+      if (!isChunked() || StatementsInChunk++ < ChunkSize)
+        return;
+      endChunk();
+      beginChunk();
+      StatementsInChunk = 1;
+    }
+
+    // void Name(i32 *Regs): runs the loop from its condition to the end on the
+    // variables the tiered interpreter keeps in Regs, at the given registers. They
+    // are copied to stack slots for the loop and back after it.
+    void runLoop(Loop &Node, ArrayRef<std::pair<StringRef, int32_t>> Registers, StringRef Name)
+    {
+      Tiered = true;
+      FunctionType *LoopTy = FunctionType::get(VoidTy, {Int32Ty->getPointerTo()}, false);
+      MainFn = Function::Create(LoopTy, GlobalValue::ExternalLinkage, Name, M);
+      Builder.SetInsertPoint(BasicBlock::Create(M->getContext(), "entry", MainFn));
+      CalcWriteFnTy = FunctionType::get(VoidTy, {Int32Ty}, false);
+      CalcWriteFn = Function::Create(CalcWriteFnTy, GlobalValue::ExternalLinkage, "ap_write", M);
+
+      SmallVector<Value *> Ptrs;
+      for (const auto &Reg : Registers)
+      {
+        Ptrs.push_back(Builder.CreateConstInBoundsGEP1_32(Int32Ty, MainFn->getArg(0), Reg.second));
+        nameMap[Reg.first] = createSlot();
+        storeVar(Reg.first, Builder.CreateLoad(Int32Ty, Ptrs.back()));
+      }
+      dispatch(Node);
+      for (size_t I = 0; I < Registers.size(); ++I)
+        Builder.CreateStore(loadVar(Registers[I].first), Ptrs[I]);
+      Builder.CreateRetVoid();
+    }
+
+    void finish()
+    {
+      if (isChunked())
+      {
+        endChunk();
+        State->setOperand(0, Builder.getInt32(std::max<size_t>(StateIndex.size(), 1)));
+        MainFn = Main;
+        Builder.SetInsertPoint(MainCallsBB);
+      }
+
+      if (Batch)
+        finishBatch();
+      else
+        // Create a return instruction at the end of the main function.
+        Builder.CreateRet(Int32Zero);
+
+      if (!Counters.empty())
+        emitProfileInit();
+      if (!Profile.empty() && Profile.size() != NextCounter)
+        errs() << "warning: profile " << ProfileUse << " was collected from a different program\n";
+    }
+
+    // void ap_batch(i32 **Columns, i32 *Results, i64 N): the column pointers are
+    // loaded once in the entry block, then the program body runs in the tuple loop
+    void beginBatch()
+    {
+      Type *Int32PtrTy = Int32Ty->getPointerTo();
+      Type *Int64Ty = Builder.getInt64Ty();
+      FunctionType *BatchTy = FunctionType::get(VoidTy, {Int32PtrTy->getPointerTo(), Int32PtrTy, Int64Ty}, false);
+      MainFn = Function::Create(BatchTy, GlobalValue::ExternalLinkage, "ap_batch", M);
+      MainFn->addParamAttr(1, Attribute::NoAlias);
+      // the vectorizer needs to know the target's vector width
+      M->setTargetTriple(sys::getDefaultTargetTriple());
+
+      BasicBlock *EntryBB = BasicBlock::Create(M->getContext(), "entry", MainFn);
+      TupleBB = BasicBlock::Create(M->getContext(), "tuple", MainFn);
+      TupleExitBB = BasicBlock::Create(M->getContext(), "tuple.exit");
+      Builder.SetInsertPoint(EntryBB);
+      for (unsigned I = 0; I < ExternVars.size(); ++I)
+        Columns.push_back(Builder.CreateLoad(Int32PtrTy, Builder.CreateConstInBoundsGEP1_32(Int32PtrTy, MainFn->getArg(0), I)));
+      Builder.CreateCondBr(Builder.CreateICmpSGT(MainFn->getArg(2), Builder.getInt64(0)), TupleBB, TupleExitBB);
+
+      Builder.SetInsertPoint(TupleBB);
+      Tuple = Builder.CreatePHI(Int64Ty, 2, "j");
+      Tuple->addIncoming(Builder.getInt64(0), EntryBB);
+    }
+
+    // store the tuple's result and close the tuple loop, then emit a main running
+    // ap_batch over the input through the runtime
+    void finishBatch()
+    {
+      Value *Result = nameMap.count("result") ? loadVar("result") : Int32Zero;
+      Builder.CreateStore(Result, Builder.CreateInBoundsGEP(Int32Ty, MainFn->getArg(1), Tuple));
+      Value *Next = Builder.CreateNUWAdd(Tuple, Builder.getInt64(1));
+      Tuple->addIncoming(Next, Builder.GetInsertBlock());
+      BranchInst *BackEdge = Builder.CreateCondBr(Builder.CreateICmpSLT(Next, MainFn->getArg(2)), TupleBB, TupleExitBB);
+      BackEdge->setMetadata(LLVMContext::MD_loop, createLoopID());
+      TupleExitBB->insertInto(MainFn);
+      Builder.SetInsertPoint(TupleExitBB);
+      Builder.CreateRetVoid();
+
+      FunctionType *MainFty = FunctionType::get(Int32Ty, {Int32Ty, Int8PtrPtrTy}, false);
+      Function *Main = Function::Create(MainFty, GlobalValue::ExternalLinkage, "main", M);
+      FunctionCallee Run = M->getOrInsertFunction("ap_run_batch", Int32Ty, Int32Ty, Int8PtrPtrTy, Int32Ty,
+                                                  MainFn->getType());
+      Builder.SetInsertPoint(BasicBlock::Create(M->getContext(), "entry", Main));
+      Builder.CreateRet(Builder.CreateCall(Run, {Main->getArg(0), Main->getArg(1),
+                                                 Builder.getInt32(ExternVars.size()), MainFn}));
     }
 
     // Visit function for the AP node in the AST.
-    virtual void visit(AP &Node) override
+    void visit(AP &Node)
     {
       // Iterate over the children of the AP node and visit each child.
       for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
       {
-        (*I)->accept(*this);
+        beginStatement();
+        dispatch(*I);
       }
     };
 
-    virtual void visit(Assignment &Node) override
+    void visit(Assignment &Node)
     {
+      // The value of a dead store is overwritten before it is read.
+      if (deadStores.count(Node.getId()))
+        return;
+
       // Visit the right-hand side of the assignment and get its value.
-      Node.getRight()->accept(*this);
+      dispatch(Node.getRight());
       Value *val = V;
 
       // Get the name of the variable being assigned.
@@ -226,59 +490,63 @@ namespace
 
         if(val != nullptr)// if right side included a dead variable ignore the assignment
         {
-          Value *var_value = Builder.CreateLoad(Int32Ty,nameMap[Node.getLeft()->getVal()]); // ex)a += 2;  -> first we should the current value of a
-          Value *temp;
-
-          switch (Node.getOperator())
-          {
-            case Assignment::Eq:
-              break;
-            case Assignment::PlEq:
-              temp = Builder.CreateNSWAdd(var_value,val);
-              val = temp;
-              break;
-            case Assignment::MulEq:
-              temp = Builder.CreateNSWMul(var_value,val);
-              val = temp;
-              break;
-            case Assignment::DivEq:
-              temp = Builder.CreateSDiv(var_value,val);
-              val = temp;
-              break;        
-            case Assignment::ModEq:
-              temp = Builder.CreateURem(var_value,val);
-              val = temp;
-              break;
-            case Assignment::MinEq:
-              temp = Builder.CreateNSWSub(var_value,val);
-              val = temp;
-              break;
-          }
+          emitWrite(varName, applyOperator(Node, val));
+        }
+      }
+    };
 
-          // Create a store instruction to assign the value to the variable.
-          Builder.CreateStore(val, nameMap[varName]);
+    // new value of the destination of an assignment whose right-hand side is val,
+    // wrapping around on overflow
+    Value *applyOperator(Assignment &Node, Value *val)
+    {
+      val = toInt(val);
 
-          // Create a function type for the "ap_write" function.
-          CalcWriteFnTy = FunctionType::get(VoidTy, {Int32Ty}, false);
-          // Create a function declaration for the "ap_write" function.
-          CalcWriteFn = Function::Create(CalcWriteFnTy, GlobalValue::ExternalLinkage, "ap_write", M);
+      // ex)a += 2;  -> first we should the current value of a
+      auto varName = Node.getLeft()->getVal();
+      Value *var_value = Node.getOperator() == Assignment::Eq ? nullptr : loadVar(varName);
 
-          // Create a call instruction to invoke the "ap_write" function with the value.
-          CallInst *Call = Builder.CreateCall(CalcWriteFnTy, CalcWriteFn, {val});
-        }
+      switch (Node.getOperator())
+      {
+        case Assignment::Eq:
+          return val;
+        case Assignment::PlEq:
+          return Builder.CreateAdd(var_value,val);
+        case Assignment::MulEq:
+          return Builder.CreateMul(var_value,val);
+        case Assignment::DivEq:
+          return Builder.CreateSDiv(var_value,val);
+        case Assignment::ModEq:
+          return Builder.CreateURem(var_value,val);
+        case Assignment::MinEq:
+          return Builder.CreateSub(var_value,val);
       }
-    };
+      return val;
+    }
+
+    // store the new value of a variable and report it through ap_write
+    void emitWrite(StringRef varName, Value *val)
+    {
+      // Create a store instruction to assign the value to the variable.
+      storeVar(varName, val);
+      // only the final result of each tuple is reported in batch mode
+      if (Batch)
+        return;
+
+      // Create a call instruction to invoke the "ap_write" function with the value.
+      Builder.CreateCall(CalcWriteFnTy, CalcWriteFn, {val});
+    }
 
-    virtual void visit(Factor &Node) override
+    void visit(Factor &Node)
     {
 
       if (Node.getKind() == Factor::Ident)
       {
 
+      Key = getIdentKey(Node.getVal());
       if (llvm::find(deadVars, Node.getVal()) == deadVars.end()) 
         {
         // If the factor is an identifier, load its value from memory.
-        V = Builder.CreateLoad(Int32Ty, nameMap[Node.getVal()]);
+        V = loadVar(Node.getVal());
         }
         else
         {
@@ -291,22 +559,62 @@ namespace
         int intval;
         Node.getVal().getAsInteger(10, intval);
         V = ConstantInt::get(Int32Ty, intval, true);
+        Key = getNumberKey(intval);
       }
     };
 
-    virtual void visit(BinaryOp &Node) override
+    void visit(BinaryOp &Node)
     {
+      // Reuse the value of a loop-invariant expression computed before the loop.
+      auto Hoist = Hoisted.find(&Node);
+      if (Hoist != Hoisted.end())
+      {
+        std::tie(V, Key) = Hoist->second;
+        return;
+      }
+
+      // In a branch condition, "and"/"or" with an expensive or trapping right-hand
+      // side only evaluate it when the left-hand side does not decide the result.
+      if (InCondition && (Node.getOperator() == BinaryOp::And || Node.getOperator() == BinaryOp::Or) &&
+          !isCheap(Node.getRight()))
+      {
+        emitShortCircuit(Node);
+        return;
+      }
+
       // Visit the left-hand side of the binary operation and get its value.
-      Node.getLeft()->accept(*this);
+      dispatch(Node.getLeft());
       Value *Left = V;     
+      unsigned LeftKey = Key;
       
       // Visit the right-hand side of the binary operation and get its value.
-      Node.getRight()->accept(*this);
+      dispatch(Node.getRight());
       Value *Right = V;
 
+      // Reuse the value of an identical expression computed earlier in this block.
+      Key = getOpKey(Node.getOperator(), LeftKey, Key);
+      if (Value *Same = getAvailable(Key))
+      {
+        V = Same;
+        return;
+      }
+
       if(Left != nullptr && Right != nullptr)
       {
+        // Logical operators work on truth values, all others on i32.
+        if (Node.getOperator() == BinaryOp::Or || Node.getOperator() == BinaryOp::And)
+        {
+          Left = toBool(Left);
+          Right = toBool(Right);
+        }
+        else if (Left->getType() != Right->getType() || Left->getType() != Int32Ty)
+        {
+          Left = toInt(Left);
+          Right = toInt(Right);
+        }
+
         // Perform the binary operation based on the operator type and create the corresponding instruction.
+        // Signed overflow wraps around, as in the interpreter and the AST optimizations.
         switch (Node.getOperator())
       {
       case BinaryOp::Or:
@@ -334,13 +642,13 @@ namespace
         V = Builder.CreateICmpSLT(Left, Right);
         break;
       case BinaryOp::Plus:
-        V = Builder.CreateNSWAdd(Left, Right);
+        V = Builder.CreateAdd(Left, Right);
         break;
       case BinaryOp::Minus:
-        V = Builder.CreateNSWSub(Left, Right);
+        V = Builder.CreateSub(Left, Right);
         break;
       case BinaryOp::Mul:
-        V = Builder.CreateNSWMul(Left, Right);
+        V = Builder.CreateMul(Left, Right);
         break;
       case BinaryOp::Div:
         V = Builder.CreateSDiv(Left, Right);
@@ -349,18 +657,41 @@ namespace
         V = Builder.CreateSRem(Left, Right);
         break;
       case BinaryOp::Pow: //ERROR
+      {
         auto *intConstant = dyn_cast<ConstantInt>(Right);
         int iterations = intConstant->getSExtValue();
         Value *NewLeft = Left;
 
         for (int i = 0; i < iterations - 1; i++)
         {
-          Left = Builder.CreateNSWMul(Left, NewLeft);
+          Left = Builder.CreateMul(Left, NewLeft);
         }
 
         V = Left;
         break;
       }
+      case BinaryOp::Shl:
+        V = Builder.CreateShl(Left, Right);
+        break;
+      case BinaryOp::AShr:
+        V = Builder.CreateAShr(Left, Right);
+        break;
+      case BinaryOp::LShr:
+        V = Builder.CreateLShr(Left, Right);
+        break;
+      case BinaryOp::BitAnd:
+        V = Builder.CreateAnd(Left, Right);
+        break;
+      case BinaryOp::MulHi:
+      {
+        Type *Int64Ty = Builder.getInt64Ty();
+        Value *Product = Builder.CreateNSWMul(Builder.CreateSExt(Left, Int64Ty),
+                                              Builder.CreateSExt(Right, Int64Ty));
+        V = Builder.CreateTrunc(Builder.CreateAShr(Product, 32), Int32Ty);
+        break;
+      }
+      }
+      setAvailable(Key, V);
       }
       else
       {
@@ -368,7 +699,7 @@ namespace
       }
     };
 
-    virtual void visit(Declaration &Node) override
+    void visit(Declaration &Node)
     {
 
       auto Exprs_iterator = Node.beginExprs();
@@ -390,19 +721,23 @@ namespace
       {
         for(Exprs_iterator;Exprs_iterator != Node.endExprs();++Exprs_iterator,++Vars_iterator)
         {
-              (*Exprs_iterator)->accept(*this);
-              Value *val = V; //V will get assigned with the final value of expression which could be assignment-BinaryOpration etc..
               StringRef Var = *Vars_iterator;
+              Value *val = loadInput(Var);
+              if (!val)
+              {
+                dispatch(*Exprs_iterator);
+                val = V; //V will get assigned with the final value of expression which could be assignment-BinaryOpration etc..
+              }
               if(val != nullptr)
               {
-                nameMap[Var] = Builder.CreateAlloca(Int32Ty);
-                Builder.CreateStore(val,nameMap[Var]);
+                declareVar(Var);
+                storeVar(Var, val);
               }
               else//just declare0
               {
                 Value *zero = ConstantInt::get(Int32Ty,0,true);
-                nameMap[Var] = Builder.CreateAlloca(Int32Ty);
-                Builder.CreateStore(zero,nameMap[Var]);
+                declareVar(Var);
+                storeVar(Var, zero);
               }
         }
         // instanciate remaining declared variables with 0
@@ -410,182 +745,1317 @@ namespace
         {
               Value *zero = ConstantInt::get(Int32Ty,0,true);
               StringRef Var = *Vars_iterator;
-              nameMap[Var] = Builder.CreateAlloca(Int32Ty);
-              Builder.CreateStore(zero,nameMap[Var]); // I think insted of zero we could use 'Int32Zero'
+              Value *Input = loadInput(Var);
+              declareVar(Var);
+              storeVar(Var, Input ? Input : zero); // I think insted of zero we could use 'Int32Zero'
         } 
       }
     };
     
-    virtual void visit(IfElse &Node) override
+    void visit(IfElse &Node)
     {
-      // Create basic blocks for if, elif, else, and merge
-      
-      BasicBlock *MergeBB = BasicBlock::Create(M->getContext(), "merge", MainFn);
-      BasicBlock *ElseBB = nullptr;
+      // counter of the statement's entry, followed by one per arm
+      unsigned Counter = allocateCounters(1 + std::distance(Node.beginAssigns2D(), Node.endAssigns2D()));
+
+      // variables assigned in any arm have unknown values from here on
+      for (auto Arm = Node.beginAssigns2D(), E = Node.endAssigns2D(); Arm != E; ++Arm)
+        for (Assignment *A : *Arm)
+          Known.erase(A->getLeft()->getVal());
+      ++Nesting;
 
-      if(Node.getHasElse())//if we have an else statment we create its BB
+      if (emitSelect(Node) || emitPredicated(Node))
+      {
+        --Nesting;
+        return;
+      }
+      emitIncrement(Counter);
+      if (emitSwitch(Node, Counter))
       {
-        ElseBB = BasicBlock::Create(M->getContext(), "else", MainFn); 
+        --Nesting;
+        return;
       }
-      // Iterate through each expression and corresponding assignments
-      auto exprIterator = Node.beginExprs();
+
+      // Each condition is tested in turn: when it holds its arm runs and control
+      // continues at merge, otherwise the next condition (or the else arm) is tried.
+      BasicBlock *MergeBB = BasicBlock::Create(M->getContext(), "merge");
       auto assignIterator = Node.beginAssigns2D();
-      
-      BasicBlock *IfBB = BasicBlock::Create(M->getContext(), "if", MainFn);// for checking conditions
-      BasicBlock *IfNotMetBB = BasicBlock::Create(M->getContext(), "if.not.met", MainFn);
-      BasicBlock *AssignBB = BasicBlock::Create(M->getContext(), "assign", MainFn);
+      unsigned ArmCounter = Counter + 1;
+      uint64_t NotTaken = getCount(Counter);
+      bool reachesElse = true;
+      for (auto exprIterator = Node.beginExprs(); exprIterator != Node.endExprs(); ++exprIterator, ++assignIterator, ++ArmCounter)
+      {
+        Value *Condition = emitCondition(*exprIterator);
+        if (!Condition)
+        {
+          // The condition only reads dead variables, so this arm and the following
+          // ones (which depend on it) only write dead variables.
+          reachesElse = false;
+          break;
+        }
 
-      Builder.CreateBr(IfBB);//check if condition
+        BasicBlock *AssignBB = BasicBlock::Create(M->getContext(), "assign", MainFn);
+        BasicBlock *IfNotMetBB = BasicBlock::Create(M->getContext(), "if.not.met", MainFn);
+        uint64_t Taken = getCount(ArmCounter);
+        NotTaken -= std::min(Taken, NotTaken);
+        Builder.CreateCondBr(Condition, AssignBB, IfNotMetBB, getBranchWeights({Taken, NotTaken}));
 
-      Builder.SetInsertPoint(IfBB);
-      // setCurr(IfBB);
-      // Eevaluate the condition
-      (*exprIterator)->accept(*this);
-      Value *Condition = V;
+        // do the required assignments, then the whole ifElse node is performed
+        Builder.SetInsertPoint(AssignBB);
+        emitIncrement(ArmCounter);
+        for (Assignment *A : *assignIterator)
+          dispatch(A);
+        Builder.CreateBr(MergeBB);
 
-      Builder.CreateCondBr(Condition,AssignBB,IfNotMetBB);
+        Builder.SetInsertPoint(IfNotMetBB);
+      }
 
-      Builder.SetInsertPoint(AssignBB);
-      // setCurr(AssignBB); 
-      // do the required assignments
-      auto IfAssignments = *assignIterator; //first row of 2D vector
-      for(auto a = IfAssignments.begin(); a != IfAssignments.end();++a)// a is represents each assignment in the first row
+      // no condition held: perform the else statement if there is one
+      if (reachesElse && Node.getHasElse())
       {
-        (*a)->accept(*this);// do each assignment in the if statement   
+        emitIncrement(ArmCounter);
+        for (Assignment *A : *assignIterator)
+          dispatch(A);
       }
-      // goto merge BB because the whole ifElse node is performed
-      Builder.CreateBr(MergeBB);  
-      // end of assignment BB
-      
-      Builder.SetInsertPoint(IfNotMetBB);
-      // setCurr(IfNotMetBB);
+      Builder.CreateBr(MergeBB);
+
+      MergeBB->insertInto(MainFn);
+      Builder.SetInsertPoint(MergeBB);
+      // setCurr(MergeBB);
+      --Nesting;
+      };
+
+    void visit(Loop &Node)
+    {
+      // counters of the loop's entry and of its body
+      unsigned Counter = allocateCounters(2);
+      LoopAnalysis Analysis(Node);
+
+      // The trip count is known when the induction variable starts from a constant
+      // and is compared against a literal or a constant variable.
+      Optional<uint64_t> TripCount;
+      if (Analysis.hasInduction())
+      {
+        auto Start = Known.find(Analysis.getIndVar());
+        Optional<int64_t> Bound = getConstant(Analysis.getBound());
+        if (Start != Known.end() && Bound)
+          TripCount = Analysis.getTripCount(Start->getValue(), *Bound);
+      }
+
+      for (auto I = Analysis.beginAssigned(), E = Analysis.endAssigned(); I != E; ++I)
+        Known.erase(I->getKey());
+      ++Nesting;
+
+      // Evaluate loop-invariant subexpressions once, before the loop.
+      SmallVector<BinaryOp *> Hoistable;
+      Analysis.collectHoistable(Hoistable);
+      for (BinaryOp *B : Hoistable)
+      {
+        dispatch(B);
+        if (V && !isa<Constant>(V))
+          Hoisted[B] = {V, Key};
+      }
+
+      emitIncrement(Counter);
+      unsigned BodySize = std::max(Analysis.getBodySize(), 1u);
+      if (TripCount && *TripCount * BodySize <= UnrollThreshold)
+      {
+        // Fully unroll: the condition is known to hold exactly TripCount times.
+        for (uint64_t I = 0; I < *TripCount; ++I)
+          emitLoopBody(Node, Counter + 1);
+      }
+      else
+      {
+        // Partially unroll by a factor dividing the trip count, so the condition
+        // only has to be checked once per unrolled iteration.
+        unsigned Factor = 1;
+        for (unsigned F : {8u, 4u, 2u})
+          if (TripCount && *TripCount % F == 0 && F * BodySize <= UnrollThreshold)
+          {
+            Factor = F;
+            break;
+          }
+        if (!emitClosedForm(Node, Analysis, Factor, Counter))
+          emitLoop(Node, Factor, Counter);
+      }
+
+      --Nesting;
+      for (BinaryOp *B : Hoistable)
+        Hoisted.erase(B);
+    };
+
+  private:
+    // comparisons and logical operators produce i1 truth values, variables hold i32
+    Value *toBool(Value *Val)
+    {
+      if (Val->getType() == Int32Ty)
+        return Builder.CreateICmpNE(Val, Int32Zero);
+      return Val;
+    }
+
+    Value *toInt(Value *Val)
+    {
+      if (Val->getType() != Int32Ty)
+        return Builder.CreateZExt(Val, Int32Ty);
+      return Val;
+    }
+
+    // rough number of instructions needed to evaluate E; expressions that may trap
+    // are never cheap, since evaluating them unconditionally could change behavior
+    unsigned getCost(Expr *E)
+    {
+      if (isStackNearlyExhausted())
+        return runOnNewStack([&] { return getCost(E); });
+      if (auto *F = dyn_cast<Factor>(E))
+        return F->getKind() == Factor::Ident ? 1 : 0;
+
+      auto *B = cast<BinaryOp>(E);
+      unsigned Cost = getCost(B->getLeft()) + getCost(B->getRight());
+      switch (B->getOperator())
+      {
+      case BinaryOp::Div:
+      case BinaryOp::Mod:
+      {
+        auto *Divisor = dyn_cast<Factor>(B->getRight());
+        int intval;
+        if (!Divisor || Divisor->getKind() != Factor::Number ||
+            Divisor->getVal().getAsInteger(10, intval) || intval == 0)
+          return ~0u / 2;
+        return Cost + 4;
+      }
+      case BinaryOp::Pow:
+      {
+        auto *Exponent = dyn_cast<Factor>(B->getRight());
+        int intval = 2;
+        if (Exponent)
+          Exponent->getVal().getAsInteger(10, intval);
+        return Cost + std::max(intval - 1, 1);
+      }
+      default:
+        return std::min(Cost + 1, ~0u / 2);
+      }
+    }
+
+    bool isCheap(Expr *E) { return getCost(E) <= ShortCircuitThreshold; }
+
+    // evaluate a branch condition as an i1, or nullptr if it reads dead variables
+    Value *emitCondition(Expr *E)
+    {
+      InCondition = true;
+      dispatch(E);
+      InCondition = false;
+      return V ? toBool(V) : nullptr;
+    }
+
+    // "a and b" branches to the evaluation of b only if a holds, "a or b" only if a
+    // does not; both paths merge in a PHI of the truth value
+    void emitShortCircuit(BinaryOp &Node)
+    {
+      bool IsAnd = Node.getOperator() == BinaryOp::And;
+
+      dispatch(Node.getLeft());
+      if (!V)
+        return;
+      Value *Left = toBool(V);
+      unsigned LeftKey = Key;
+      BasicBlock *LeftBB = Builder.GetInsertBlock();
+
+      BasicBlock *RightBB = BasicBlock::Create(M->getContext(), IsAnd ? "and.rhs" : "or.rhs", MainFn);
+      BasicBlock *EndBB = BasicBlock::Create(M->getContext(), IsAnd ? "and.end" : "or.end", MainFn);
+      if (IsAnd)
+        Builder.CreateCondBr(Left, RightBB, EndBB);
+      else
+        Builder.CreateCondBr(Left, EndBB, RightBB);
 
-      // if we have iterated all expressions if and all elif statements have been checked
-      // so we should either perfrom else statement or merge
-      if(exprIterator == Node.endExprs())
+      Builder.SetInsertPoint(RightBB);
+      dispatch(Node.getRight());
+      Value *Right = V ? toBool(V) : nullptr;
+      BasicBlock *RightEndBB = Builder.GetInsertBlock();
+      Builder.CreateBr(EndBB);
+
+      Builder.SetInsertPoint(EndBB);
+      Key = getOpKey(Node.getOperator(), LeftKey, Key);
+      if (!Right)
+      {
+        V = nullptr;
+        return;
+      }
+
+      PHINode *Phi = Builder.CreatePHI(Left->getType(), 2);
+      Phi->addIncoming(ConstantInt::getBool(M->getContext(), !IsAnd), LeftBB);
+      Phi->addIncoming(Right, RightEndBB);
+      V = Phi;
+      setAvailable(Key, V);
+    }
+
+    // If every arm, else included, is a single assignment to the same variable and
+    // the conditions and right-hand sides are cheap and cannot trap, evaluate them
+    // all and pick the new value with a chain of selects instead of branching.
+    bool emitSelect(IfElse &Node)
+    {
+      // instrumented arms need blocks of their own
+      if (!SelectThreshold || !Node.getHasElse() || isInstrumented())
+        return false;
+
+      StringRef Var;
+      unsigned Cost = 0;
+      SmallVector<Assignment *> Arms;
+      for (auto I = Node.beginAssigns2D(), E = Node.endAssigns2D(); I != E; ++I)
       {
-        if(Node.getHasElse())
+        if (I->size() != 1)
+          return false;
+        Assignment *A = I->front();
+        if ((!Var.empty() && A->getLeft()->getVal() != Var) || deadStores.count(A->getId()))
+          return false;
+        Var = A->getLeft()->getVal();
+
+        Cost += getCost(A->getRight()) + 1;
+        if (mayTrap(A))
+          return false;
+        Arms.push_back(A);
+      }
+      for (auto I = Node.beginExprs(), E = Node.endExprs(); I != E; ++I)
+        Cost += getCost(*I);
+      if (Cost > SelectThreshold)
+        return false;
+
+      // assignments to a dead variable are dropped along with the statement
+      if (llvm::find(deadVars, Var) != deadVars.end())
+        return true;
+
+      SmallVector<Value *> Conditions;
+      for (auto I = Node.beginExprs(), E = Node.endExprs(); I != E; ++I)
+      {
+        dispatch(*I);
+        if (!V)
+          return true;
+        Conditions.push_back(toBool(V));
+      }
+
+      SmallVector<Value *> Values;
+      for (Assignment *A : Arms)
+      {
+        dispatch(A->getRight());
+        if (!V)
+          return true;
+        Values.push_back(applyOperator(*A, V));
+      }
+
+      // the first arm whose condition holds wins, the else arm is the fallback
+      Value *Result = Values.back();
+      for (size_t I = Conditions.size(); I-- > 0;)
+        Result = Builder.CreateSelect(Conditions[I], Values[I], Result);
+      emitWrite(Var, Result);
+      return true;
+    }
+
+    // whether evaluating the assignment where it would not run could trap
+    bool mayTrap(Assignment *A)
+    {
+      if (getCost(A->getRight()) >= ~0u / 2)
+        return true;
+      if (A->getOperator() != Assignment::DivEq && A->getOperator() != Assignment::ModEq)
+        return false;
+      auto *Divisor = dyn_cast<Factor>(A->getRight());
+      int intval;
+      return !Divisor || Divisor->getKind() != Factor::Number ||
+             Divisor->getVal().getAsInteger(10, intval) || intval == 0;
+    }
+
+    // In batch mode every arm of an if statement that cannot trap is evaluated, and
+    // each variable it assigns takes the value from the first arm whose condition
+    // holds, so the tuple loop has no branches left to keep it from vectorizing.
+    bool emitPredicated(IfElse &Node)
+    {
+      if (!Batch)
+        return false;
+      for (auto I = Node.beginExprs(), E = Node.endExprs(); I != E; ++I)
+        if (getCost(*I) >= ~0u / 2)
+          return false;
+
+      SmallVector<StringRef> Vars; // live variables assigned in any arm
+      for (auto Arm = Node.beginAssigns2D(), E = Node.endAssigns2D(); Arm != E; ++Arm)
+        for (Assignment *A : *Arm)
         {
-          ++assignIterator;
-          Builder.CreateBr(AssignBB);
+          if (mayTrap(A))
+            return false;
+          StringRef Var = A->getLeft()->getVal();
+          if (llvm::find(deadVars, Var) == deadVars.end() && llvm::find(Vars, Var) == Vars.end())
+            Vars.push_back(Var);
         }
-        else
+
+      // a condition reading dead variables only guards assignments to dead variables,
+      // like the arms after it
+      SmallVector<Value *> Conditions;
+      bool ReachesElse = Node.getHasElse();
+      for (auto I = Node.beginExprs(), E = Node.endExprs(); I != E; ++I)
+      {
+        dispatch(*I);
+        if (!V)
+        {
+          ReachesElse = false;
+          break;
+        }
+        Conditions.push_back(toBool(V));
+      }
+
+      // every arm starts from the values before the statement; its results are set
+      // aside and the variables restored for the next arm
+      SmallVector<Value *> Before;
+      for (StringRef Var : Vars)
+        Before.push_back(loadVar(Var));
+      SmallVector<SmallVector<Value *>> After;
+      auto Arm = Node.beginAssigns2D();
+      for (size_t I = 0, E = Conditions.size() + ReachesElse; I != E; ++I, ++Arm)
+      {
+        for (Assignment *A : *Arm)
+          dispatch(A);
+        After.emplace_back();
+        for (size_t J = 0; J < Vars.size(); ++J)
         {
-          Builder.CreateBr(MergeBB);
+          After.back().push_back(loadVar(Vars[J]));
+          storeVar(Vars[J], Before[J]);
         }
       }
 
-      ++exprIterator;
-      ++assignIterator;
+      for (size_t J = 0; J < Vars.size(); ++J)
+      {
+        Value *Result = ReachesElse ? After.back()[J] : Before[J];
+        for (size_t I = Conditions.size(); I-- > 0;)
+          Result = Builder.CreateSelect(Conditions[I], After[I][J], Result);
+        storeVar(Vars[J], Result);
+      }
+      return true;
+    }
+
+    // "x == literal" or "literal == x": the variable and the literal's value
+    bool matchEquality(Expr *E, StringRef &Var, int64_t &Val)
+    {
+      auto *B = dyn_cast<BinaryOp>(E);
+      if (!B || B->getOperator() != BinaryOp::IsEq)
+        return false;
+      auto *L = dyn_cast<Factor>(B->getLeft());
+      auto *R = dyn_cast<Factor>(B->getRight());
+      if (!L || !R || L->getKind() == R->getKind())
+        return false;
+      if (L->getKind() == Factor::Number)
+        std::swap(L, R);
+      Var = L->getVal();
+      return !R->getVal().getAsInteger(10, Val) && Val == int32_t(Val);
+    }
+
+    // An if/elif chain whose conditions all compare the same variable against a
+    // literal dispatches through one switch, so the backend can use a jump table or
+    // a binary search instead of testing the arms one by one.
+    bool emitSwitch(IfElse &Node, unsigned Counter)
+    {
+      if (!SwitchMinArms || std::distance(Node.beginExprs(), Node.endExprs()) < SwitchMinArms)
+        return false;
+
+      StringRef SwitchVar;
+      SmallVector<int64_t> Cases;
+      for (auto I = Node.beginExprs(), E = Node.endExprs(); I != E; ++I)
+      {
+        StringRef Var;
+        int64_t Val;
+        if (!matchEquality(*I, Var, Val) || (!SwitchVar.empty() && Var != SwitchVar))
+          return false;
+        SwitchVar = Var;
+        Cases.push_back(Val);
+      }
+
+      // a dead variable only controls assignments to dead variables
+      if (llvm::find(deadVars, SwitchVar) != deadVars.end())
+        return true;
+
+      Value *Scrutinee = loadVar(SwitchVar);
+      BasicBlock *MergeBB = BasicBlock::Create(M->getContext(), "merge");
+      BasicBlock *DefaultBB = MergeBB;
+      if (Node.getHasElse())
+        DefaultBB = BasicBlock::Create(M->getContext(), "else", MainFn);
+      SwitchInst *Switch = Builder.CreateSwitch(Scrutinee, DefaultBB, Cases.size());
+
+      auto assignIterator = Node.beginAssigns2D();
+      unsigned ArmCounter = Counter + 1;
+      SmallPtrSet<ConstantInt *, 16> Seen;
+      SmallVector<uint64_t> Weights{getCount(Counter)}; // the default's weight comes first
+      for (int64_t Val : Cases)
+      {
+        auto Arm = *assignIterator++;
+        unsigned Count = ArmCounter++;
+        // a repeated constant can never select a later arm
+        auto *Case = cast<ConstantInt>(ConstantInt::get(Int32Ty, Val, true));
+        if (!Seen.insert(Case).second)
+          continue;
+
+        BasicBlock *AssignBB = BasicBlock::Create(M->getContext(), "case", MainFn);
+        Switch->addCase(Case, AssignBB);
+        Weights.push_back(getCount(Count));
+        Weights[0] -= std::min(Weights.back(), Weights[0]);
+        Builder.SetInsertPoint(AssignBB);
+        emitIncrement(Count);
+        for (Assignment *A : Arm)
+          dispatch(A);
+        Builder.CreateBr(MergeBB);
+      }
+      if (MDNode *BranchWeights = getBranchWeights(Weights))
+        Switch->setMetadata(LLVMContext::MD_prof, BranchWeights);
 
-      Builder.CreateBr(IfBB);
-      // end of IfNotMet BB
+      if (Node.getHasElse())
+      {
+        Builder.SetInsertPoint(DefaultBB);
+        emitIncrement(ArmCounter);
+        for (Assignment *A : *assignIterator)
+          dispatch(A);
+        Builder.CreateBr(MergeBB);
+      }
 
+      MergeBB->insertInto(MainFn);
       Builder.SetInsertPoint(MergeBB);
-      // setCurr(MergeBB);
+      return true;
+    }
+
+    unsigned getIdentKey(StringRef Var)
+    {
+      auto Inserted = IdentKeys.try_emplace(Var, NextKey);
+      if (Inserted.second)
+        KeyReads[NextKey++].push_back(Var);
+      return Inserted.first->getValue();
+    }
+
+    unsigned getNumberKey(int64_t Val)
+    {
+      auto Inserted = NumberKeys.try_emplace(Val, NextKey);
+      if (Inserted.second)
+        ++NextKey;
+      return Inserted.first->second;
+    }
+
+    unsigned getOpKey(BinaryOp::Operator Op, unsigned LeftKey, unsigned RightKey)
+    {
+      auto Inserted = OpKeys.try_emplace(std::make_tuple(unsigned(Op), LeftKey, RightKey), NextKey);
+      if (Inserted.second)
+      {
+        SmallVector<StringRef> &Reads = KeyReads[NextKey++];
+        Reads = KeyReads.lookup(LeftKey);
+        appendDepends(Reads, KeyReads.lookup(RightKey));
+      }
+      return Inserted.first->second;
+    }
+
+    // value of the expression with key K if it was computed in the current block
+    Value *getAvailable(unsigned K)
+    {
+      if (!EnableCSE)
+        return nullptr;
+      if (AvailableBB != Builder.GetInsertBlock())
+      {
+        Available.clear();
+        KeyUsers.clear();
+        AvailableBB = Builder.GetInsertBlock();
+      }
+      return Available.lookup(K);
+    }
+
+    void setAvailable(unsigned K, Value *Val)
+    {
+      if (!EnableCSE || getAvailable(K))
+        return;
+      Available[K] = Val;
+      for (StringRef Var : KeyReads.lookup(K))
+        KeyUsers[Var].push_back(K);
+    }
+
+    Value *loadVar(StringRef Var)
+    {
+      unsigned K = getIdentKey(Var);
+      if (Value *Val = getAvailable(K))
+        return Val;
+      Value *Val = Builder.CreateLoad(Int32Ty, getSlot(Var));
+      setAvailable(K, Val);
+      return Val;
+    }
+
+    // store to a variable, forgetting the values that read it; the stored value is
+    // what a following load of the variable would return
+    void storeVar(StringRef Var, Value *Val)
+    {
+      Val = toInt(Val);
+      Builder.CreateStore(Val, getSlot(Var));
+      recordStore(Var, Val);
+
+      getAvailable(0);
+      auto Users = KeyUsers.find(Var);
+      if (Users != KeyUsers.end())
+      {
+        for (unsigned K : Users->getValue())
+          Available.erase(K);
+        Users->getValue().clear();
+      }
+      setAvailable(getIdentKey(Var), Val);
+    }
+
+    // stack slot of a variable; those of the batch function go in its entry block so
+    // the tuple loop does not allocate, and so do those of chunks, which are created
+    // at the first use of the variable
+    AllocaInst *createSlot()
+    {
+      if (!Batch && !isChunked())
+        return Builder.CreateAlloca(Int32Ty);
+      BasicBlock &EntryBB = MainFn->getEntryBlock();
+      return IRBuilder<>(&EntryBB, EntryBB.begin()).CreateAlloca(Int32Ty);
+    }
+
+    void declareVar(StringRef Var)
+    {
+      nameMap[Var] = createSlot();
+      if (isChunked())
+        StateIndex.try_emplace(Var, StateIndex.size());
+    }
+
+    // slot of a variable in the current function; a chunk copies the variables of
+    // earlier chunks in from the state on entry
+    AllocaInst *getSlot(StringRef Var)
+    {
+      AllocaInst *&Slot = nameMap[Var];
+      if (Slot || !isChunked())
+        return Slot;
+      auto I = StateIndex.find(Var);
+      if (I == StateIndex.end())
+        return nullptr;
+      BasicBlock &EntryBB = MainFn->getEntryBlock();
+      IRBuilder<> EntryBuilder(&EntryBB, EntryBB.begin());
+      Slot = EntryBuilder.CreateAlloca(Int32Ty);
+      Value *Ptr = EntryBuilder.CreateConstInBoundsGEP1_32(Int32Ty, MainFn->getArg(0), I->getValue());
+      EntryBuilder.CreateStore(EntryBuilder.CreateLoad(Int32Ty, Ptr), Slot);
+      return Slot;
+    }
+
+    // remember constant values stored by straight-line code, used for trip counts
+    void recordStore(StringRef Var, Value *Val)
+    {
+      auto *C = dyn_cast<ConstantInt>(Val);
+      if (C && !Nesting)
+        Known[Var] = C->getSExtValue();
+      else
+        Known.erase(Var);
+    }
+
+    // value of a literal or of a variable holding a known constant
+    Optional<int64_t> getConstant(Expr *E)
+    {
+      auto *F = dyn_cast_or_null<Factor>(E);
+      if (!F)
+        return None;
+      if (F->getKind() == Factor::Ident)
+      {
+        auto I = Known.find(F->getVal());
+        if (I == Known.end())
+          return None;
+        return I->getValue();
+      }
+      int64_t Val;
+      if (F->getVal().getAsInteger(10, Val))
+        return None;
+      return Val;
+    }
+
+    // Replace a loop recognized by LoopAnalysis::hasClosedForm with the values its
+    // variables have after the last iteration, which are reported once. The trip
+    // count is computed at run time; if the induction variable would overflow, the
+    // loop runs normally.
+    bool emitClosedForm(Loop &Node, LoopAnalysis &Analysis, unsigned Factor, unsigned Counter)
+    {
+      // the tiered interpreter has reported the earlier iterations one by one, so the
+      // compiled loop reports the remaining ones the same way
+      if (!ClosedFormLoops || isInstrumented() || Tiered || !Analysis.hasClosedForm() ||
+          llvm::find(deadVars, Analysis.getIndVar()) != deadVars.end())
+        return false;
+
+      // trip count and last value of the induction variable, in i64
+      Type *Int64Ty = Builder.getInt64Ty();
+      dispatch(Analysis.getBound());
+      if (!V)
+        return false;
+      Value *Bound = Builder.CreateSExt(toInt(V), Int64Ty);
+      Value *Start = Builder.CreateSExt(loadVar(Analysis.getIndVar()), Int64Ty);
+      int64_t Step = Analysis.getStep();
+      Value *Distance = Step > 0 ? Builder.CreateSub(Bound, Start) : Builder.CreateSub(Start, Bound);
+      Constant *AbsStep = ConstantInt::get(Int64Ty, Step > 0 ? Step : -Step);
+      Constant *Zero = ConstantInt::get(Int64Ty, 0);
+      Value *Trips;
+      BinaryOp::Operator Pred = Analysis.getPredicate();
+      if (Pred == BinaryOp::LoEq || Pred == BinaryOp::GrEq)
+        Trips = Builder.CreateSelect(Builder.CreateICmpSGE(Distance, Zero),
+                                     Builder.CreateAdd(Builder.CreateSDiv(Distance, AbsStep),
+                                                       ConstantInt::get(Int64Ty, 1)),
+                                     Zero);
+      else
+        Trips = Builder.CreateSelect(Builder.CreateICmpSGT(Distance, Zero),
+                                     Builder.CreateSDiv(Builder.CreateAdd(Distance, Builder.CreateSub(AbsStep, ConstantInt::get(Int64Ty, 1))),
+                                                        AbsStep),
+                                     Zero);
+      Value *Last = Builder.CreateAdd(Start, Builder.CreateMul(Trips, ConstantInt::get(Int64Ty, Step)));
+      Value *Fits = Step > 0 ? Builder.CreateICmpSLE(Last, ConstantInt::get(Int64Ty, INT32_MAX))
+                             : Builder.CreateICmpSGE(Last, ConstantInt::get(Int64Ty, INT32_MIN));
+      auto *KnownFits = dyn_cast<ConstantInt>(Fits);
+      if (KnownFits && KnownFits->isZero())
+        return false;
+
+      BasicBlock *ClosedBB = BasicBlock::Create(M->getContext(), "closed.form", MainFn);
+      BasicBlock *ClosedBodyBB = BasicBlock::Create(M->getContext(), "closed.form.body", MainFn);
+      BasicBlock *FallbackBB = nullptr;
+      BasicBlock *ExitBB = BasicBlock::Create(M->getContext(), "loop.exit");
+      if (KnownFits)
+        Builder.CreateBr(ClosedBB);
+      else
+      {
+        FallbackBB = BasicBlock::Create(M->getContext(), "closed.form.fallback", MainFn);
+        Builder.CreateCondBr(Fits, ClosedBB, FallbackBB);
+      }
+
+      // nothing is assigned or reported when the loop does not run
+      Builder.SetInsertPoint(ClosedBB);
+      Builder.CreateCondBr(Builder.CreateICmpNE(Trips, Zero), ClosedBodyBB, ExitBB);
+
+      // C(k, d) mod 2^32 for the last iteration k = Trips - 1, computed exactly in
+      // i128 since the products of up to MaxDegree factors below 2^32 fit there
+      Builder.SetInsertPoint(ClosedBodyBB);
+      Type *Int128Ty = Builder.getInt128Ty();
+      Value *K = Builder.CreateZExt(Builder.CreateSub(Trips, ConstantInt::get(Int64Ty, 1)), Int128Ty);
+      SmallVector<Value *> Binomials{Builder.getInt32(1)};
+      Value *Binomial = ConstantInt::get(Int128Ty, 1);
+      for (unsigned D = 1; D <= LoopAnalysis::MaxDegree; ++D)
+      {
+        Value *Factor = Builder.CreateSub(K, ConstantInt::get(Int128Ty, D - 1));
+        Binomial = Builder.CreateUDiv(Builder.CreateMul(Binomial, Factor), ConstantInt::get(Int128Ty, D));
+        Binomials.push_back(Builder.CreateTrunc(Binomial, Int32Ty));
+      }
+
+      // the values of all variables are computed from their values before the loop
+      // before any of them is stored
+      SmallVector<std::pair<StringRef, Value *>> Finals;
+      for (unsigned Pos = 0; Pos < Analysis.getBodySize(); ++Pos)
+      {
+        Assignment *A = Analysis.getAssignment(Pos);
+        StringRef Var = A->getLeft()->getVal();
+        if (llvm::find(deadVars, Var) != deadVars.end() || deadStores.count(A->getId()))
+          continue;
+        Poly P = getAfterPoly(Analysis, Pos);
+        Value *Final = Int32Zero;
+        for (unsigned D = 0; D < P.size(); ++D)
+          Final = Builder.CreateAdd(Final, Builder.CreateMul(P[D], Binomials[D]));
+        Finals.push_back({Var, Final});
+      }
+      for (auto &Final : Finals)
+        emitWrite(Final.first, Final.second);
+      Builder.CreateBr(ExitBB);
+      StartPolys.clear();
+
+      if (FallbackBB)
+      {
+        Builder.SetInsertPoint(FallbackBB);
+        emitLoop(Node, Factor, Counter);
+        Builder.CreateBr(ExitBB);
+      }
+
+      ExitBB->insertInto(MainFn);
+      Builder.SetInsertPoint(ExitBB);
+      return true;
+    }
+
+    // value of E at position Pos of the body in iteration k
+    Poly getPoly(LoopAnalysis &Analysis, Expr *E, unsigned Pos)
+    {
+      if (isStackNearlyExhausted())
+        return runOnNewStack([&] { return getPoly(Analysis, E, Pos); });
+      if (Analysis.isSafeInvariant(E))
+      {
+        dispatch(E);
+        return {V ? toInt(V) : Int32Zero};
+      }
+
+      if (auto *F = dyn_cast<Factor>(E))
+      {
+        unsigned Assigned = Analysis.getPosition(F->getVal());
+        return Assigned < Pos ? getAfterPoly(Analysis, Assigned) : getStartPoly(Analysis, Assigned);
+      }
+
+      auto *B = cast<BinaryOp>(E);
+      Poly Left = getPoly(Analysis, B->getLeft(), Pos);
+      if (B->getOperator() == BinaryOp::Shl)
+      {
+        auto *Shift = cast<Factor>(B->getRight());
+        int intval;
+        Shift->getVal().getAsInteger(10, intval);
+        for (Value *&C : Left)
+          C = Builder.CreateShl(C, intval);
+        return Left;
+      }
+
+      Poly Right = getPoly(Analysis, B->getRight(), Pos);
+      if (B->getOperator() == BinaryOp::Mul)
+        return mulPoly(Left, Right);
+
+      // Plus or Minus
+      Left.resize(std::max(Left.size(), Right.size()), Int32Zero);
+      for (unsigned D = 0; D < Right.size(); ++D)
+        Left[D] = B->getOperator() == BinaryOp::Plus ? Builder.CreateAdd(Left[D], Right[D])
+                                                      : Builder.CreateSub(Left[D], Right[D]);
+      return Left;
+    }
+
+    // C(k, m) * C(k, n) = sum over j of C(m + n - j, m) * C(m, j) * C(k, m + n - j)
+    Poly mulPoly(const Poly &Left, const Poly &Right)
+    {
+      auto Choose = [](uint64_t N, uint64_t R) {
+        uint64_t C = 1;
+        for (uint64_t I = 1; I <= R; ++I)
+          C = C * (N - R + I) / I;
+        return C;
       };
 
-    virtual void visit(Loop &Node) override
-    {  
+      Poly Product(Left.size() + Right.size() - 1, Int32Zero);
+      for (unsigned Mi = 0; Mi < Left.size(); ++Mi)
+        for (unsigned Ni = 0; Ni < Right.size(); ++Ni)
+        {
+          Value *Term = Builder.CreateMul(Left[Mi], Right[Ni]);
+          for (unsigned J = 0; J <= std::min(Mi, Ni); ++J)
+          {
+            uint64_t Scale = Choose(Mi + Ni - J, Mi) * Choose(Mi, J);
+            Product[Mi + Ni - J] = Builder.CreateAdd(Product[Mi + Ni - J],
+                                                     Builder.CreateMul(Term, Builder.getInt32(Scale)));
+          }
+        }
+      return Product;
+    }
+
+    // value of the variable assigned at Pos at the start of iteration k
+    Poly getStartPoly(LoopAnalysis &Analysis, unsigned Pos)
+    {
+      auto Memo = StartPolys.find(Pos);
+      if (Memo != StartPolys.end())
+        return Memo->second;
+
+      // the value before the loop plus the sum of the increments of iterations 0 to k - 1,
+      // where the sum of C(j, d) for j < k is C(k, d + 1)
+      Assignment *A = Analysis.getAssignment(Pos);
+      Poly Increment = getPoly(Analysis, A->getRight(), Pos);
+      Poly P{loadVar(A->getLeft()->getVal())};
+      for (Value *C : Increment)
+        P.push_back(A->getOperator() == Assignment::MinEq ? Builder.CreateNeg(C) : C);
+      StartPolys[Pos] = P;
+      return P;
+    }
+
+    // value of the variable assigned at Pos right after its assignment in iteration k
+    Poly getAfterPoly(LoopAnalysis &Analysis, unsigned Pos)
+    {
+      Assignment *A = Analysis.getAssignment(Pos);
+      if (A->getOperator() == Assignment::Eq)
+        return getPoly(Analysis, A->getRight(), Pos);
+
+      // the start value of iteration k + 1, as C(k + 1, d) = C(k, d) + C(k, d - 1)
+      Poly P = getStartPoly(Analysis, Pos);
+      for (unsigned D = 0; D + 1 < P.size(); ++D)
+        P[D] = Builder.CreateAdd(P[D], P[D + 1]);
+      return P;
+    }
+
+    // the input value of an external variable, or nullptr for other variables
+    Value *loadInput(StringRef Var)
+    {
+      auto I = llvm::find(ExternVars, Var);
+      if (I == ExternVars.end())
+        return nullptr;
+      if (Batch)
+        return Builder.CreateLoad(Int32Ty, Builder.CreateInBoundsGEP(Int32Ty, Columns[I - ExternVars.begin()], Tuple));
+      Value *Ptr = Builder.CreateConstInBoundsGEP1_32(Int32Ty, Inputs, I - ExternVars.begin());
+      return Builder.CreateLoad(Int32Ty, Ptr);
+    }
+
+    // the counters are registered with the runtime once per run of main, which the
+    // batch function is not
+    bool isInstrumented() { return Instrument && !Batch && !Tiered; }
+
+    // reserve N consecutive profiling counters and return the first one
+    unsigned allocateCounters(unsigned N)
+    {
+      unsigned First = NextCounter;
+      NextCounter += N;
+      if (isInstrumented())
+        for (unsigned I = 0; I < N; ++I)
+          Counters.push_back(new GlobalVariable(*M, Builder.getInt64Ty(), false,
+                                                GlobalValue::PrivateLinkage,
+                                                Builder.getInt64(0), "ap.count"));
+      return First;
+    }
+
+    void emitIncrement(unsigned Counter)
+    {
+      if (!isInstrumented())
+        return;
+      GlobalVariable *Count = Counters[Counter];
+      Value *Old = Builder.CreateLoad(Builder.getInt64Ty(), Count);
+      Builder.CreateStore(Builder.CreateAdd(Old, Builder.getInt64(1)), Count);
+    }
+
+    // hand the counters to the runtime first thing in main, it writes them out at exit
+    void emitProfileInit()
+    {
+      Type *Int64PtrTy = Builder.getInt64Ty()->getPointerTo();
+      ArrayType *TableTy = ArrayType::get(Int64PtrTy, Counters.size());
+      SmallVector<Constant *> Elements(Counters.begin(), Counters.end());
+      auto *Table = new GlobalVariable(*M, TableTy, true, GlobalValue::PrivateLinkage,
+                                       ConstantArray::get(TableTy, Elements), "ap.counters");
+      FunctionCallee Init = M->getOrInsertFunction("ap_profile_init", VoidTy,
+                                                   Int64PtrTy->getPointerTo(), Int32Ty);
+
+      IRBuilder<> EntryBuilder(&MainFn->getEntryBlock(), MainFn->getEntryBlock().begin());
+      EntryBuilder.CreateCall(Init, {EntryBuilder.CreateConstInBoundsGEP2_32(TableTy, Table, 0, 0),
+                                     EntryBuilder.getInt32(Counters.size())});
+    }
+
+    // the profile holds the number of counters, then one count per line
+    void loadProfile()
+    {
+      auto BufferOrErr = MemoryBuffer::getFile(ProfileUse);
+      if (std::error_code EC = BufferOrErr.getError())
+      {
+        errs() << "warning: cannot read profile " << ProfileUse << ": " << EC.message() << "\n";
+        return;
+      }
+
+      SmallVector<StringRef> Lines;
+      (*BufferOrErr)->getBuffer().split(Lines, '\n', -1, false);
+      uint64_t Size;
+      if (Lines.empty() || Lines[0].trim().getAsInteger(10, Size) || Size != Lines.size() - 1)
+      {
+        errs() << "warning: malformed profile " << ProfileUse << "\n";
+        return;
+      }
+      Profile.resize(Size);
+      for (uint64_t I = 0; I < Size; ++I)
+        if (Lines[I + 1].trim().getAsInteger(10, Profile[I]))
+        {
+          errs() << "warning: malformed profile " << ProfileUse << "\n";
+          Profile.clear();
+          return;
+        }
+    }
+
+    uint64_t getCount(unsigned Counter)
+    {
+      return Counter < Profile.size() ? Profile[Counter] : 0;
+    }
+
+    // branch weights for the given execution counts of the successors, or nullptr
+    // if there is no profile or the branch never ran
+    MDNode *getBranchWeights(ArrayRef<uint64_t> Counts)
+    {
+      uint64_t Max = Counts.empty() ? 0 : *std::max_element(Counts.begin(), Counts.end());
+      if (Max == 0)
+        return nullptr;
+
+      // weights are 32-bit, scale large counts down
+      uint64_t Scale = Max / UINT32_MAX + 1;
+      SmallVector<uint32_t> Weights;
+      for (uint64_t Count : Counts)
+        Weights.push_back(Count / Scale + 1);
+      return MDBuilder(M->getContext()).createBranchWeights(Weights);
+    }
+
+    void emitLoopBody(Loop &Node, unsigned Counter)
+    {
+      emitIncrement(Counter);
+      for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
+        dispatch(*I);
+    }
+
+    // loop metadata asking the loop vectorizer to vectorize this loop
+    MDNode *createLoopID()
+    {
+      LLVMContext &Ctx = M->getContext();
+      Metadata *Vectorize[] = {
+          MDString::get(Ctx, "llvm.loop.vectorize.enable"),
+          ConstantAsMetadata::get(ConstantInt::getTrue(Ctx))};
+      auto Self = MDNode::getTemporary(Ctx, None);
+      Metadata *Ops[] = {Self.get(), MDNode::get(Ctx, Vectorize)};
+      MDNode *LoopID = MDNode::getDistinct(Ctx, Ops);
+      LoopID->replaceOperandWith(0, LoopID);
+      return LoopID;
+    }
+
+    void emitLoop(Loop &Node, unsigned Factor, unsigned Counter)
+    {
       BasicBlock *LoopCondBB = BasicBlock::Create(M->getContext(), "loop.cond", MainFn);
       BasicBlock *LoopBodyBB = BasicBlock::Create(M->getContext(), "loop.body", MainFn);
       BasicBlock *AfterLoopBB = BasicBlock::Create(M->getContext(), "after.loop", MainFn);
-      
-      // Emit LLVM IR instructions
+
       Builder.CreateBr(LoopCondBB);
       Builder.SetInsertPoint(LoopCondBB);
-      // setCurr(LoopCondBB);
 
-      // Assuming there's a function to emit the loop condition expression
-      Node.getCondition()->accept(*this);
-      Value *Condition = V;
-      Builder.CreateCondBr(Condition, LoopBodyBB, AfterLoopBB);
-      
-      Builder.SetInsertPoint(LoopBodyBB);
-      // setCurr(LoopBodyBB);
-
-      // accept statements within the loop body
-      
-      auto assignment_iterator = Node.begin(); //  Node.begin() retrieves loop assignments/statements
-      for(assignment_iterator;assignment_iterator != Node.end();++assignment_iterator)
+      Value *Condition = emitCondition(Node.getCondition());
+      if (!Condition)
       {
-        (*assignment_iterator)->accept(*this);
+        // The condition only reads dead variables, so the body only writes dead
+        // variables as well and the loop can be dropped.
+        Builder.CreateBr(AfterLoopBB);
+        LoopBodyBB->eraseFromParent();
+        Builder.SetInsertPoint(AfterLoopBB);
+        return;
       }
-      Builder.CreateBr(LoopCondBB);//current = LoopbodyBB -> we want to branch to LoopCondBB
+      // the condition is checked once per Factor iterations and once more on exit
+      Builder.CreateCondBr(Condition, LoopBodyBB, AfterLoopBB,
+                           getBranchWeights({getCount(Counter + 1) / Factor, getCount(Counter)}));
+
+      Builder.SetInsertPoint(LoopBodyBB);
+      for (unsigned I = 0; I < Factor; ++I)
+        emitLoopBody(Node, Counter + 1);
+      BranchInst *BackEdge = Builder.CreateBr(LoopCondBB);
+      BackEdge->setMetadata(LLVMContext::MD_loop, createLoopID());
 
       Builder.SetInsertPoint(AfterLoopBB);
-      // setCurr(AfterLoopBB);
-    };
+    }
   };
 }; // namespace
 
-void CodeGen::collectIdentifiers(AST *Tree)
+// write the module as textual IR, bitcode or a native object through a large
+// buffered stream; returns false after a diagnostic
+static bool emitModule(Module *M)
+{
+  if (NoOutput)
+    return true;
+
+  // keep the dead variable report ahead of the module when both go to stdout
+  outs().flush();
+
+  std::error_code EC;
+  raw_fd_ostream OS(OutputFilename, EC,
+                    EmitBitcode || EmitObject ? sys::fs::OF_None : sys::fs::OF_TextWithCRLF);
+  if (EC)
+  {
+    errs() << "Cannot open " << OutputFilename << ": " << EC.message() << "\n";
+    return false;
+  }
+  OS.SetBufferSize(1 << 20);
+
+  if (EmitObject)
+    return emitObject(*M, OS, Jobs);
+
+  NamedRegionTimer T("output", "Module output", "ap", "AP compiler phases",
+                     TimePassesIsEnabled);
+
+  if (EmitBitcode)
+    WriteBitcodeToFile(*M, OS);
+  else
+    M->print(OS, nullptr);
+  return true;
+}
+
+// the external variables, as the AST optimizations and the interpreter take them
+static ArrayRef<StringRef> getInputs()
 {
-  IdentifiersCollector IdentifierCollector;
-  IdentifierCollector.collect(Tree);
+  static SmallVector<StringRef> Inputs(ExternVars.begin(), ExternVars.end());
+  return Inputs;
 }
 
-void CodeGen::computeDepends(AST *Tree){
-  ComputeDepends computeDepends;
-  computeDepends.compute(Tree);
-  
+void CodeGen::optimize(AST *Tree)
+{
+  if (Optimized)
+    return;
+  Optimized = true;
+
+  NamedRegionTimer T("optimize", "AST optimization", "ap", "AP compiler phases",
+                     TimePassesIsEnabled);
+  if (PropagateConstants)
+  {
+    Propagation = std::make_unique<ConstantPropagation>(deadVars, deadStores, getInputs());
+    Propagation->run(*cast<AP>(Tree));
+  }
+  if (StrengthReduce)
+  {
+    Reduction = std::make_unique<StrengthReduction>();
+    Reduction->run(Tree);
+  }
+}
+
+// the statements replacing Statement after the AST optimizations, in the streaming
+// modes; the literals they create are owned by Propagation and Reduction
+static void optimizeStatement(Expr *Statement, ConstantPropagation &Propagation,
+                              StrengthReduction &Reduction, SmallVectorImpl<Expr *> &Statements)
+{
+  Statements.clear();
+  if (PropagateConstants)
+    Propagation.run(Statement, Statements);
+  else
+    Statements.push_back(Statement);
+  if (StrengthReduce)
+    for (Expr *S : Statements)
+      Reduction.run(S);
+}
+
+int CodeGen::compile(AST *Tree)
+{
+  // Create an LLVM context and a module.
+  LLVMContext Ctx;
+  Module *M = new Module("calc.expr", Ctx);
+
+  optimize(Tree);
+
+  // Create an instance of the ToIRVisitor and run it on the AST to generate LLVM IR.
+  {
+    NamedRegionTimer T("codegen", "IR generation", "ap", "AP compiler phases",
+                       TimePassesIsEnabled);
+    ToIRVisitor ToIR(M);
+    ToIR.run(Tree);
+  }
+
+  // Write the generated module to the output file.
+  return emitModule(M) ? 0 : 1;
 }
 
-// initialize deadVars
-void CodeGen::computeDead()
+
+// pass 2 of streaming mode: reparse the program and emit IR one statement at a time
+int CodeGen::compileStreaming(Parser &P)
 {
-  void addDependenciesRecursive(const llvm::StringRef &variable, llvm::SmallVector<llvm::StringRef> &alive);
+  LLVMContext Ctx;
+  Module *M = new Module("calc.expr", Ctx);
 
-  llvm::SmallVector<llvm::StringRef> resultDepends = dependsMap["result"];//error prone
-  for(const auto &variable : resultDepends)
   {
-    addDependenciesRecursive(variable, alive);
+    NamedRegionTimer T("codegen", "IR generation", "ap", "AP compiler phases",
+                       TimePassesIsEnabled);
+    ToIRVisitor ToIR(M);
+    ConstantPropagation Propagation(deadVars, deadStores, getInputs());
+    StrengthReduction Reduction;
+    SmallVector<Expr *> Statements;
+    ToIR.begin();
+    while (Expr *Statement = P.parseNext())
+    {
+      optimizeStatement(Statement, Propagation, Reduction, Statements);
+      for (Expr *S : Statements)
+      {
+        ToIR.beginStatement();
+        ToIR.dispatch(S);
+        delete S;
+      }
+    }
+    ToIR.finish();
   }
 
-  for(const auto &variable : allVars)
+  return emitModule(M) ? 0 : 1;
+}
+
+// live variables read or assigned by E, each added to Vars once
+static void collectVariables(Expr *E, SmallVectorImpl<StringRef> &Vars)
+{
+  if (isStackNearlyExhausted())
+    return runOnNewStack([&] { return collectVariables(E, Vars); });
+  if (auto *B = dyn_cast<BinaryOp>(E))
   {
-    // Check if var is not in alive
-    if (llvm::find(alive,variable ) == alive.end()) 
+    collectVariables(B->getLeft(), Vars);
+    collectVariables(B->getRight(), Vars);
+    return;
+  }
+  auto *F = cast<Factor>(E);
+  if (F->getKind() == Factor::Ident && llvm::find(deadVars, F->getVal()) == deadVars.end() &&
+      llvm::find(Vars, F->getVal()) == Vars.end())
+    Vars.push_back(F->getVal());
+}
+
+void CodeGen::compileLoop(Loop &Node, ArrayRef<std::pair<StringRef, int32_t>> Registers,
+                          Module *M, StringRef Name)
+{
+  ToIRVisitor ToIR(M);
+  ToIR.runLoop(Node, Registers, Name);
+}
+
+// the values of the external variables, read like ap_read_inputs does: from the
+// file named by AP_INPUT_FILE or stdin, separated by whitespace or commas; false
+// after a diagnostic
+static bool readInputs(std::vector<int32_t> &Values)
+{
+  if (ExternVars.empty())
+    return true;
+  const char *Path = getenv("AP_INPUT_FILE");
+  auto BufferOrErr = MemoryBuffer::getFileOrSTDIN(Path ? Path : "-");
+  if (!BufferOrErr)
+  {
+    errs() << "Cannot open input " << (Path ? Path : "-") << "\n";
+    return false;
+  }
+  StringRef Text = (*BufferOrErr)->getBuffer();
+  for (unsigned I = 0; I < ExternVars.size(); ++I)
+  {
+    Text = Text.ltrim(" ,\n\r\t");
+    bool Negative = Text.consume_front("-");
+    if (!Negative)
+      Text.consume_front("+");
+    size_t Digits = Text.find_first_not_of("0123456789");
+    if (Digits == 0 || Text.empty())
     {
-        // Add var to deadVars
-        if(variable != "result")
-        {
-          deadVars.push_back(variable);
-        }
+      errs() << "Input value " << I + 1 << " is missing or invalid\n";
+      return false;
     }
+    // wrapping modulo 2^32 like the runtime
+    uint32_t Val = 0;
+    for (char C : Text.take_front(Digits))
+      Val = Val * 10 + (C - '0');
+    Text = Text.drop_front(std::min(Digits, Text.size()));
+    Values.push_back(static_cast<int32_t>(Negative ? -Val : Val));
   }
-  for (const auto &var : deadVars)
+  return true;
+}
+
+// the values of the external variables, read once; nullptr after a diagnostic
+static const std::vector<int32_t> *getInputValues()
+{
+  static std::vector<int32_t> Values;
+  static bool Valid = readInputs(Values);
+  return Valid ? &Values : nullptr;
+}
+
+// whether the code compiled for E behaves like the interpreter: compiled division
+// traps on a divisor that is not a nonzero literal where the interpreter reports a
+// runtime error, and only literal exponents can be compiled
+static bool isCompilable(Expr *E)
+{
+  if (isStackNearlyExhausted())
+    return runOnNewStack([&] { return isCompilable(E); });
+  auto *B = dyn_cast<BinaryOp>(E);
+  if (!B)
+    return true;
+  if (B->getOperator() == BinaryOp::Div || B->getOperator() == BinaryOp::Mod ||
+      B->getOperator() == BinaryOp::Pow)
   {
-    llvm::outs() << "variable '" << var << "' is dead." << "\n";
+    auto *F = dyn_cast<Factor>(B->getRight());
+    int Val;
+    if (!F || F->getKind() != Factor::Number || F->getVal().getAsInteger(10, Val) ||
+        (Val == 0 && B->getOperator() != BinaryOp::Pow))
+      return false;
   }
+  return isCompilable(B->getLeft()) && isCompilable(B->getRight());
+}
 
+static bool isCompilable(Loop &Node)
+{
+  if (!isCompilable(Node.getCondition()))
+    return false;
+  for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
+  {
+    Assignment *A = *I;
+    if (A->getOperator() == Assignment::DivEq || A->getOperator() == Assignment::ModEq)
+    {
+      auto *F = dyn_cast<Factor>(A->getRight());
+      int Val;
+      if (!F || F->getKind() != Factor::Number || F->getVal().getAsInteger(10, Val) || Val == 0)
+        return false;
+    }
+    if (!isCompilable(A->getRight()))
+      return false;
+  }
+  return true;
 }
 
-//auxiliary function to perfrom the recursive algorithm that finds variables that "result" variable is dependent on them
-void addDependenciesRecursive(const llvm::StringRef &variable, llvm::SmallVector<llvm::StringRef> &alive) {
-    // Check if the variable is already in the 'alive' vector to avoid duplicates
-    if (llvm::find(alive, variable) == alive.end()) {
-        // Add the variable to 'alive'
-        alive.push_back(variable);
-
-        // Recursively add dependencies
-        const auto &dependencies = dependsMap[variable];
-        for (const auto &dependency : dependencies) {
-            addDependenciesRecursive(dependency, alive);
-        }
+// interpret the program, compiling each loop that gets hot and running the rest of
+// it natively
+int CodeGen::runTiered(AST *Tree)
+{
+  std::unique_ptr<LoopJIT> JIT = LoopJIT::create(*this);
+  if (!JIT)
+    return interpret(Tree);
+
+  const std::vector<int32_t> *InputValues = getInputValues();
+  if (!InputValues)
+    return 1;
+  optimize(Tree);
+  Interpreter Interp(deadVars, deadStores, getInputs());
+  {
+    NamedRegionTimer T("bytecode", "Bytecode generation", "ap", "AP compiler phases",
+                       TimePassesIsEnabled);
+    Interp.compile(Tree);
+  }
+  Interp.setTierUp(TierThreshold, [&](Loop &Node, int32_t *Regs) {
+    // loops that may trap are left to the interpreter, which reports the error
+    if (!isCompilable(Node))
+      return false;
+    SmallVector<StringRef> Vars;
+    collectVariables(Node.getCondition(), Vars);
+    for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
+    {
+      collectVariables((*I)->getLeft(), Vars);
+      collectVariables((*I)->getRight(), Vars);
     }
+    SmallVector<std::pair<StringRef, int32_t>> Registers;
+    for (StringRef Var : Vars)
+      Registers.push_back({Var, Interp.getRegister(Var)});
+    return JIT->run(Node, Registers, Regs);
+  });
+  return Interp.run(outs(), *InputValues);
 }
 
-void CodeGen::compile(AST *Tree)
+// run the program on the bytecode interpreter instead of generating IR
+int CodeGen::interpret(AST *Tree)
 {
-  // Create an LLVM context and a module.
-  LLVMContext Ctx;
-  Module *M = new Module("calc.expr", Ctx);
+  const std::vector<int32_t> *InputValues = getInputValues();
+  if (!InputValues)
+    return 1;
+  optimize(Tree);
+  Interpreter Interp(deadVars, deadStores, getInputs());
+  {
+    NamedRegionTimer T("bytecode", "Bytecode generation", "ap", "AP compiler phases",
+                       TimePassesIsEnabled);
+    Interp.compile(Tree);
+  }
+  NamedRegionTimer T("interpret", "Interpretation", "ap", "AP compiler phases",
+                     TimePassesIsEnabled);
+  return Interp.run(outs(), *InputValues);
+}
 
-  // Create an instance of the ToIRVisitor and run it on the AST to generate LLVM IR.
-  ToIRVisitor ToIR(M);
-  ToIR.run(Tree);
+// pass 2 of streaming mode for the interpreter: only the bytecode is kept
+int CodeGen::interpretStreaming(Parser &P)
+{
+  const std::vector<int32_t> *InputValues = getInputValues();
+  if (!InputValues)
+    return 1;
+  Interpreter Interp(deadVars, deadStores, getInputs());
+  {
+    NamedRegionTimer T("bytecode", "Bytecode generation", "ap", "AP compiler phases",
+                       TimePassesIsEnabled);
+    ConstantPropagation Propagation(deadVars, deadStores, getInputs());
+    StrengthReduction Reduction;
+    SmallVector<Expr *> Statements;
+    while (Expr *Statement = P.parseNext())
+    {
+      optimizeStatement(Statement, Propagation, Reduction, Statements);
+      for (Expr *S : Statements)
+      {
+        Interp.compile(S);
+        delete S;
+      }
+    }
+  }
+  NamedRegionTimer T("interpret", "Interpretation", "ap", "AP compiler phases",
+                     TimePassesIsEnabled);
+  return Interp.run(outs(), *InputValues);
+}
+
+// interpret the program before and after the AST optimizations and compare what
+// both runs report
+bool CodeGen::verifyOptimizations(AST *Tree)
+{
+  const std::vector<int32_t> *InputValues = getInputValues();
+  if (!InputValues)
+    return true;
+  auto Run = [&](std::string &Out) {
+    Interpreter Interp(deadVars, deadStores, getInputs());
+    Interp.compile(Tree);
+    raw_string_ostream OS(Out);
+    return Interp.run(OS, *InputValues);
+  };
 
-  // Print the generated module to the standard output.
-  M->print(outs(), nullptr);
+  std::string Before, After;
+  int BeforeStatus = Run(Before);
+  optimize(Tree);
+  int AfterStatus = Run(After);
+  return BeforeStatus != AfterStatus || Before != After;
 }
@@ -2,13 +2,51 @@
 #define CODEGEN_H
 
 #include "AST.h"
+#include "llvm/ADT/ArrayRef.h"
+#include <memory>
+#include <utility>
+
+class Parser;
+class ConstantPropagation;
+class StrengthReduction;
+
+namespace llvm
+{
+ class Module;
+ class raw_ostream;
+}
 
 class CodeGen
 {
+ // the AST optimizations run by optimize, which own the literals they create
+ std::unique_ptr<ConstantPropagation> Propagation;
+ std::unique_ptr<StrengthReduction> Reduction;
+ bool Optimized = false;
+
 public:
- void compile(AST *Tree);
+ CodeGen();
+ ~CodeGen();
+ // run the AST optimizations on Tree, once; every mode runs the optimized tree
+ void optimize(AST *Tree);
+ // interpret Tree before and after optimize; true if the two runs report different
+ // values
+ bool verifyOptimizations(AST *Tree);
+ int compile(AST *Tree);
+ bool analyze(AST *Tree);
+ bool verifyAnalysis(AST *Tree);
  void collectIdentifiers(AST *Tree);
  void computeDepends(AST *Tree);
- void computeDead();
+ void computeDead(bool Report = true);
+ // write the live and dead variables and the dependencies as JSON
+ void writeAnalysis(llvm::raw_ostream &OS);
+ bool analyzeStreaming(Parser &P);
+ int compileStreaming(Parser &P);
+ int interpret(AST *Tree);
+ int interpretStreaming(Parser &P);
+ int runTiered(AST *Tree);
+ // emit into M a function Name running Node on the variables kept in an array of
+ // i32, at the given indices
+ void compileLoop(Loop &Node, llvm::ArrayRef<std::pair<llvm::StringRef, int32_t>> Registers,
+                  llvm::Module *M, llvm::StringRef Name);
 };
 #endif
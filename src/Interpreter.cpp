@@ -0,0 +1,409 @@
+#include "Interpreter.h"
+#include "llvm/ADT/STLExtras.h"
+#include <climits>
+
+using namespace llvm;
+
+// GCC and Clang can jump through a table of label addresses, so every handler ends
+// with its own indirect jump to the next one instead of going back to a switch.
+#if defined(__GNUC__)
+#define AP_THREADED_DISPATCH 1
+#endif
+
+namespace
+{
+  int32_t wrap(uint32_t Val) { return static_cast<int32_t>(Val); }
+
+  // Base multiplied by itself Exponent - 1 times, modulo 2^32
+  int32_t power(int32_t Base, int32_t Exponent)
+  {
+    uint32_t Result = Base, Factor = Base;
+    for (uint32_t N = Exponent > 1 ? Exponent - 1 : 0; N; N >>= 1)
+    {
+      if (N & 1)
+        Result *= Factor;
+      Factor *= Factor;
+    }
+    return wrap(Result);
+  }
+}
+
+bool Interpreter::isDead(StringRef Var)
+{
+  return llvm::find(DeadVars, Var) != DeadVars.end();
+}
+
+int32_t Interpreter::getVar(StringRef Var)
+{
+  auto I = Vars.try_emplace(Var, Vars.size());
+  NumRegs = std::max<int32_t>(NumRegs, Vars.size());
+  return I.first->getValue();
+}
+
+size_t Interpreter::emit(Opcode Op, int32_t A, int32_t B, int32_t C)
+{
+  if (Op != Jump && Op != JumpIf && Op != JumpIfNot && Op != LoopBack && Op != Write)
+    NumRegs = std::max(NumRegs, A + 1);
+  Code.push_back({Op, A, B, C});
+  return Code.size() - 1;
+}
+
+int32_t Interpreter::compileExpr(Expr *E, int32_t Target)
+{
+  if (isStackNearlyExhausted())
+    return runOnNewStack([&] { return compileExpr(E, Target); });
+  if (auto *F = dyn_cast<Factor>(E))
+  {
+    if (F->getKind() == Factor::Ident)
+      return isDead(F->getVal()) ? -1 : getVar(F->getVal());
+    int Val = 0;
+    F->getVal().getAsInteger(10, Val);
+    emit(LoadK, Target, Val);
+    return Target;
+  }
+
+  auto *B = cast<BinaryOp>(E);
+  int32_t Left = compileExpr(B->getLeft(), Target);
+  int32_t Right = compileExpr(B->getRight(), Target + 1);
+  if (Left < 0 || Right < 0)
+    return -1;
+
+  Opcode Op;
+  switch (B->getOperator())
+  {
+  case BinaryOp::Or:    Op = Or; break;
+  case BinaryOp::And:   Op = And; break;
+  case BinaryOp::IsEq:  Op = Eq; break;
+  case BinaryOp::IsNEq: Op = Ne; break;
+  case BinaryOp::GrEq:  Op = Ge; break;
+  case BinaryOp::LoEq:  Op = Le; break;
+  case BinaryOp::Gr:    Op = Gt; break;
+  case BinaryOp::Lo:    Op = Lt; break;
+  case BinaryOp::Plus:  Op = Add; break;
+  case BinaryOp::Minus: Op = Sub; break;
+  case BinaryOp::Mul:   Op = Mul; break;
+  case BinaryOp::Div:   Op = Div; break;
+  case BinaryOp::Mod:   Op = Rem; break;
+  case BinaryOp::Pow:   Op = Pow; break;
+  case BinaryOp::Shl:   Op = Shl; break;
+  case BinaryOp::AShr:  Op = AShr; break;
+  case BinaryOp::LShr:  Op = LShr; break;
+  case BinaryOp::BitAnd: Op = BitAnd; break;
+  case BinaryOp::MulHi: Op = MulHi; break;
+  }
+  emit(Op, Target, Left, Right);
+  return Target;
+}
+
+int32_t Interpreter::compileCondition(Expr *E, int32_t Target)
+{
+  if (isStackNearlyExhausted())
+    return runOnNewStack([&] { return compileCondition(E, Target); });
+  auto *B = dyn_cast<BinaryOp>(E);
+  if (!B || (B->getOperator() != BinaryOp::And && B->getOperator() != BinaryOp::Or))
+    return compileExpr(E, Target);
+
+  // the truth value of the left-hand side decides "a and b" when false and
+  // "a or b" when true, the right-hand side is only evaluated otherwise
+  int32_t Left = compileCondition(B->getLeft(), Target);
+  if (Left < 0)
+    return -1;
+  emit(Test, Target, Left);
+  size_t Skip = emit(B->getOperator() == BinaryOp::And ? JumpIfNot : JumpIf, Target);
+  int32_t Right = compileCondition(B->getRight(), Target + 1);
+  if (Right < 0)
+    return -1;
+  emit(Test, Target, Right);
+  patch(Skip);
+  return Target;
+}
+
+void Interpreter::compileAssignments(ArrayRef<Assignment *> Assignments)
+{
+  for (Assignment *A : Assignments)
+    dispatch(A);
+}
+
+void Interpreter::visit(AP &Node)
+{
+  for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
+    dispatch(*I);
+}
+
+void Interpreter::visit(Assignment &Node)
+{
+  StringRef Var = Node.getLeft()->getVal();
+  if (DeadStores.count(Node.getId()) || isDead(Var))
+    return;
+
+  int32_t Reg = getVar(Var);
+  int32_t Temp = getFirstTemp();
+  int32_t Val = compileExpr(Node.getRight(), Temp);
+  if (Val < 0)
+    return;
+
+  switch (Node.getOperator())
+  {
+  case Assignment::Eq:
+    // the right-hand side computed into a temporary by its last instruction can be
+    // computed into the variable's register directly
+    if (Val == Temp && Code.back().A == Temp)
+      Code.back().A = Reg;
+    else
+      emit(Move, Reg, Val);
+    break;
+  case Assignment::PlEq:
+    emit(Add, Reg, Reg, Val);
+    break;
+  case Assignment::MinEq:
+    emit(Sub, Reg, Reg, Val);
+    break;
+  case Assignment::MulEq:
+    emit(Mul, Reg, Reg, Val);
+    break;
+  case Assignment::DivEq:
+    emit(Div, Reg, Reg, Val);
+    break;
+  case Assignment::ModEq:
+    emit(URem, Reg, Reg, Val);
+    break;
+  }
+  emit(Write, Reg);
+}
+
+void Interpreter::visit(Declaration &Node)
+{
+  // registers are assigned before the initializers use the temporaries above them
+  for (auto I = Node.beginVars(), E = Node.endVars(); I != E; ++I)
+    getVar(*I);
+
+  // the declaration goes away with its first variable if that is dead
+  if (isDead(*Node.beginVars()))
+    return;
+
+  auto Init = Node.beginExprs();
+  for (auto I = Node.beginVars(), E = Node.endVars(); I != E; ++I)
+  {
+    int32_t Reg = getVar(*I);
+    int32_t Val = -1;
+    // external variables ignore their initializers
+    auto Input = llvm::find(Inputs, *I);
+    if (Input != Inputs.end())
+    {
+      if (Init != Node.endExprs())
+        ++Init;
+      emit(Interpreter::Input, Reg, Input - Inputs.begin());
+      continue;
+    }
+    if (Init != Node.endExprs())
+      Val = compileExpr(*Init++, getFirstTemp());
+    if (Val < 0)
+      emit(LoadK, Reg, 0);
+    else if (Val == getFirstTemp() && Code.back().A == Val)
+      Code.back().A = Reg;
+    else
+      emit(Move, Reg, Val);
+  }
+}
+
+void Interpreter::visit(IfElse &Node)
+{
+  // a condition reading dead variables only guards assignments to dead variables,
+  // and so do the arms after it
+  SmallVector<size_t> ToEnd;
+  auto Arm = Node.beginAssigns2D();
+  bool ReachesElse = Node.getHasElse();
+  for (auto I = Node.beginExprs(), E = Node.endExprs(); I != E; ++I, ++Arm)
+  {
+    size_t Before = Code.size();
+    int32_t Cond = compileCondition(*I, getFirstTemp());
+    if (Cond < 0)
+    {
+      Code.resize(Before);
+      ReachesElse = false;
+      break;
+    }
+    size_t Next = emit(JumpIfNot, Cond);
+    compileAssignments(*Arm);
+    ToEnd.push_back(emit(Jump, 0));
+    patch(Next);
+  }
+  if (ReachesElse)
+    compileAssignments(*Arm);
+  for (size_t J : ToEnd)
+    patch(J);
+}
+
+void Interpreter::visit(Loop &Node)
+{
+  // the condition is tested at the bottom, after a jump to it on entry
+  size_t Entry = emit(Jump, 0);
+  size_t Body = Code.size();
+  compileAssignments(SmallVector<Assignment *>(Node.begin(), Node.end()));
+  size_t Cond = Code.size();
+  int32_t Reg = compileCondition(Node.getCondition(), getFirstTemp());
+  if (Reg < 0)
+  {
+    // the loop only writes dead variables
+    Code.resize(Entry);
+    return;
+  }
+  emit(LoopBack, Reg, Body, Loops.size());
+  Loops.push_back(&Node);
+  Code[Entry].A = Cond;
+}
+
+int Interpreter::run(raw_ostream &Out, ArrayRef<int32_t> InputValues)
+{
+  if (Code.empty() || Code.back().Op != Halt)
+    emit(Halt, 0);
+
+  std::vector<int32_t> Regs(NumRegs, 0);
+  int32_t *R = Regs.data();
+  const Instr *Begin = Code.data();
+  const Instr *PC = Begin;
+  const char *Error = nullptr;
+  std::vector<unsigned> BackEdges(TierUp && TierThreshold ? Loops.size() : 0);
+
+#ifdef AP_THREADED_DISPATCH
+#define AP_OPCODE_LABEL(Name) &&Do##Name,
+  static const void *const Labels[] = {AP_OPCODES(AP_OPCODE_LABEL)};
+#undef AP_OPCODE_LABEL
+#define CASE(Name) Do##Name:
+#define DISPATCH() goto *Labels[PC->Op]
+#else
+#define CASE(Name) case Name:
+#define DISPATCH() continue
+#endif
+#define NEXT() { ++PC; DISPATCH(); }
+#define JUMP(Target) { PC = Begin + (Target); DISPATCH(); }
+
+#ifdef AP_THREADED_DISPATCH
+  DISPATCH();
+#else
+  for (;;)
+    switch (PC->Op)
+#endif
+  {
+    CASE(LoadK)
+    R[PC->A] = PC->B;
+    NEXT();
+    CASE(Move)
+    R[PC->A] = R[PC->B];
+    NEXT();
+    CASE(Input)
+    R[PC->A] = InputValues[PC->B];
+    NEXT();
+    CASE(Add)
+    R[PC->A] = wrap(uint32_t(R[PC->B]) + uint32_t(R[PC->C]));
+    NEXT();
+    CASE(Sub)
+    R[PC->A] = wrap(uint32_t(R[PC->B]) - uint32_t(R[PC->C]));
+    NEXT();
+    CASE(Mul)
+    R[PC->A] = wrap(uint32_t(R[PC->B]) * uint32_t(R[PC->C]));
+    NEXT();
+    CASE(Div)
+    if (R[PC->C] == 0 || (R[PC->B] == INT32_MIN && R[PC->C] == -1))
+    {
+      Error = "division by zero or overflow";
+      goto Done;
+    }
+    R[PC->A] = R[PC->B] / R[PC->C];
+    NEXT();
+    CASE(Rem)
+    if (R[PC->C] == 0 || (R[PC->B] == INT32_MIN && R[PC->C] == -1))
+    {
+      Error = "division by zero or overflow";
+      goto Done;
+    }
+    R[PC->A] = R[PC->B] % R[PC->C];
+    NEXT();
+    CASE(URem)
+    if (R[PC->C] == 0)
+    {
+      Error = "division by zero";
+      goto Done;
+    }
+    R[PC->A] = wrap(uint32_t(R[PC->B]) % uint32_t(R[PC->C]));
+    NEXT();
+    CASE(Pow)
+    R[PC->A] = power(R[PC->B], R[PC->C]);
+    NEXT();
+    CASE(Shl)
+    R[PC->A] = wrap(uint32_t(R[PC->B]) << (R[PC->C] & 31));
+    NEXT();
+    CASE(AShr)
+    R[PC->A] = R[PC->B] >> (R[PC->C] & 31);
+    NEXT();
+    CASE(LShr)
+    R[PC->A] = wrap(uint32_t(R[PC->B]) >> (R[PC->C] & 31));
+    NEXT();
+    CASE(BitAnd)
+    R[PC->A] = R[PC->B] & R[PC->C];
+    NEXT();
+    CASE(MulHi)
+    R[PC->A] = wrap(uint64_t(int64_t(R[PC->B]) * int64_t(R[PC->C])) >> 32);
+    NEXT();
+    CASE(Eq)
+    R[PC->A] = R[PC->B] == R[PC->C];
+    NEXT();
+    CASE(Ne)
+    R[PC->A] = R[PC->B] != R[PC->C];
+    NEXT();
+    CASE(Lt)
+    R[PC->A] = R[PC->B] < R[PC->C];
+    NEXT();
+    CASE(Le)
+    R[PC->A] = R[PC->B] <= R[PC->C];
+    NEXT();
+    CASE(Gt)
+    R[PC->A] = R[PC->B] > R[PC->C];
+    NEXT();
+    CASE(Ge)
+    R[PC->A] = R[PC->B] >= R[PC->C];
+    NEXT();
+    CASE(And)
+    R[PC->A] = R[PC->B] != 0 && R[PC->C] != 0;
+    NEXT();
+    CASE(Or)
+    R[PC->A] = R[PC->B] != 0 || R[PC->C] != 0;
+    NEXT();
+    CASE(Test)
+    R[PC->A] = R[PC->B] != 0;
+    NEXT();
+    CASE(Jump)
+    JUMP(PC->A);
+    CASE(JumpIf)
+    if (R[PC->A])
+      JUMP(PC->B);
+    NEXT();
+    CASE(JumpIfNot)
+    if (!R[PC->A])
+      JUMP(PC->B);
+    NEXT();
+    CASE(LoopBack)
+    if (!R[PC->A])
+      NEXT();
+    // the callback runs the loop from its condition to the end, on the registers
+    if (!BackEdges.empty() && ++BackEdges[PC->C] == TierThreshold && TierUp(*Loops[PC->C], R))
+      NEXT();
+    JUMP(PC->B);
+    CASE(Write)
+    Out << "The result is: " << R[PC->A] << "\n";
+    NEXT();
+    CASE(Halt)
+    goto Done;
+  }
+#undef CASE
+#undef NEXT
+#undef JUMP
+#undef DISPATCH
+
+Done:
+  if (!Error)
+    return 0;
+  Out.flush();
+  errs() << "Runtime error: " << Error << "\n";
+  return 1;
+}
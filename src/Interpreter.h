@@ -0,0 +1,138 @@
+#ifndef INTERPRETER_H
+#define INTERPRETER_H
+
+#include "AST.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Bytecode operations of the register machine; R is the register file, A, B and C
+// the operands of the instruction.
+#define AP_OPCODES(X)                                         \
+  X(LoadK)     /* R[A] = B */                                 \
+  X(Move)      /* R[A] = R[B] */                              \
+  X(Input)     /* R[A] = external input B */                  \
+  X(Add)       /* R[A] = R[B] + R[C], wrapping like i32 */    \
+  X(Sub)                                                      \
+  X(Mul)                                                      \
+  X(Div)       /* signed, traps on zero and overflow */       \
+  X(Rem)       /* signed */                                   \
+  X(URem)      /* unsigned, for %= */                         \
+  X(Pow)       /* R[A] = R[B] multiplied R[C] - 1 times */    \
+  X(Shl)       /* the operators of the AST optimizer */      \
+  X(AShr)                                                     \
+  X(LShr)                                                     \
+  X(BitAnd)                                                   \
+  X(MulHi)     /* high half of the 64-bit product */          \
+  X(Eq)        /* R[A] = R[B] == R[C], 0 or 1 */              \
+  X(Ne)                                                       \
+  X(Lt)                                                       \
+  X(Le)                                                       \
+  X(Gt)                                                       \
+  X(Ge)                                                       \
+  X(And)       /* R[A] = R[B] != 0 && R[C] != 0 */            \
+  X(Or)                                                       \
+  X(Test)      /* R[A] = R[B] != 0 */                         \
+  X(Jump)      /* continue at instruction A */                \
+  X(JumpIf)    /* continue at instruction B if R[A] != 0 */   \
+  X(JumpIfNot)                                                \
+  X(LoopBack)  /* JumpIf, counting the back edges of loop C */ \
+  X(Write)     /* report R[A] like ap_write */                \
+  X(Halt)
+
+// Interpreter compiles statements to bytecode for a register machine and runs it
+// without building any LLVM IR, for programs whose run time is dwarfed by that of
+// code generation. Every variable has a register of its own, temporaries use the
+// registers above them. The program behaves like the compiled one without its
+// optimizations: assignments report their values, dead variables and dead
+// stores are skipped, and external variables take their values from the input.
+class Interpreter : public StaticASTVisitor<Interpreter>
+{
+public:
+  enum Opcode : uint8_t
+  {
+#define AP_OPCODE_ENUM(Name) Name,
+    AP_OPCODES(AP_OPCODE_ENUM)
+#undef AP_OPCODE_ENUM
+  };
+
+  struct Instr
+  {
+    Opcode Op;
+    int32_t A, B, C;
+  };
+
+private:
+  llvm::ArrayRef<llvm::StringRef> DeadVars;
+  const llvm::DenseMap<unsigned, llvm::StringRef> &DeadStores;
+  llvm::ArrayRef<llvm::StringRef> Inputs; // external variables, in input order
+
+  std::vector<Instr> Code;
+  llvm::StringMap<int32_t> Vars; // register of each variable
+  int32_t NumRegs = 0;
+  std::vector<Loop *> Loops; // by loop number
+
+  // called when a loop takes its TierThreshold-th back edge, with the register file;
+  // returns true if it ran the rest of the loop
+  std::function<bool(Loop &, int32_t *)> TierUp;
+  unsigned TierThreshold = 0;
+
+  bool isDead(llvm::StringRef Var);
+  int32_t getVar(llvm::StringRef Var);
+  size_t emit(Opcode Op, int32_t A, int32_t B = 0, int32_t C = 0);
+  // make a jump emitted earlier continue at the next instruction emitted
+  void patch(size_t Branch) { (Code[Branch].Op == Jump ? Code[Branch].A : Code[Branch].B) = Code.size(); }
+
+  // register holding the value of E, computed into Target if E is not a variable
+  // (registers above Target are free), or -1 if E reads a dead variable
+  int32_t compileExpr(Expr *E, int32_t Target);
+  // the same for a branch condition, whose and/or operators short-circuit
+  int32_t compileCondition(Expr *E, int32_t Target);
+  void compileAssignments(llvm::ArrayRef<Assignment *> Assignments);
+
+  int32_t getFirstTemp() { return Vars.size(); }
+
+public:
+  Interpreter(llvm::ArrayRef<llvm::StringRef> DeadVars,
+              const llvm::DenseMap<unsigned, llvm::StringRef> &DeadStores,
+              llvm::ArrayRef<llvm::StringRef> Inputs = {})
+      : DeadVars(DeadVars), DeadStores(DeadStores), Inputs(Inputs) {}
+
+  // append the bytecode of a statement, or of every statement of a program
+  void compile(AST *Statement) { dispatch(Statement); }
+
+  // run the bytecode compiled so far on the values of the external variables,
+  // writing the reported values to Out; returns nonzero after a runtime error
+  int run(llvm::raw_ostream &Out, llvm::ArrayRef<int32_t> InputValues = {});
+
+  size_t getCodeSize() { return Code.size(); }
+
+  // register of a variable, or -1 if the program has none
+  int32_t getRegister(llvm::StringRef Var)
+  {
+    auto I = Vars.find(Var);
+    return I == Vars.end() ? -1 : I->getValue();
+  }
+
+  // hand loops over to Callback once they take Threshold back edges; the loops
+  // compiled so far must still be alive when the program runs
+  void setTierUp(unsigned Threshold, std::function<bool(Loop &, int32_t *)> Callback)
+  {
+    TierThreshold = Threshold;
+    TierUp = std::move(Callback);
+  }
+
+  void visit(AP &Node);
+  void visit(Factor &) {}
+  void visit(BinaryOp &) {}
+  void visit(Assignment &Node);
+  void visit(Declaration &Node);
+  void visit(IfElse &Node);
+  void visit(Loop &Node);
+};
+
+#endif
@@ -0,0 +1,76 @@
+#include "JIT.h"
+#include "Backend.h"
+#include "CodeGen.h"
+#include "llvm/ExecutionEngine/Orc/Mangling.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+namespace
+{
+  // ap_write of the compiled loops, reporting values like the interpreter
+  void writeValue(int32_t Val)
+  {
+    outs() << "The result is: " << Val << "\n";
+  }
+}
+
+std::unique_ptr<LoopJIT> LoopJIT::create(CodeGen &CG)
+{
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+
+  auto JIT = orc::LLJITBuilder().create();
+  if (!JIT)
+  {
+    errs() << "warning: no JIT, interpreting only: " << toString(JIT.takeError()) << "\n";
+    return nullptr;
+  }
+
+  orc::MangleAndInterner Mangle((*JIT)->getExecutionSession(), (*JIT)->getDataLayout());
+  orc::SymbolMap Runtime;
+  Runtime[Mangle("ap_write")] = JITEvaluatedSymbol(pointerToJITTargetAddress(&writeValue),
+                                                   JITSymbolFlags::Exported);
+  if (Error E = (*JIT)->getMainJITDylib().define(orc::absoluteSymbols(std::move(Runtime))))
+  {
+    errs() << "warning: no JIT, interpreting only: " << toString(std::move(E)) << "\n";
+    return nullptr;
+  }
+  return std::unique_ptr<LoopJIT>(new LoopJIT(CG, std::move(*JIT)));
+}
+
+bool LoopJIT::run(::Loop &Node, ArrayRef<std::pair<StringRef, int32_t>> Registers, int32_t *Regs)
+{
+  void (*Fn)(int32_t *);
+  {
+    NamedRegionTimer T("jit", "Loop compilation", "ap", "AP compiler phases",
+                       TimePassesIsEnabled);
+    auto Ctx = std::make_unique<LLVMContext>();
+    auto M = std::make_unique<Module>("ap.loop", *Ctx);
+    M->setDataLayout(JIT->getDataLayout());
+    M->setTargetTriple(JIT->getTargetTriple().str());
+
+    std::string Name = ("ap.loop." + Twine(NextLoop++)).str();
+    CG.compileLoop(Node, Registers, M.get(), Name);
+    optimizeForCodeGen(*M);
+
+    if (Error E = JIT->addIRModule(orc::ThreadSafeModule(std::move(M), std::move(Ctx))))
+    {
+      errs() << "warning: cannot compile loop: " << toString(std::move(E)) << "\n";
+      return false;
+    }
+    auto Sym = JIT->lookup(Name);
+    if (!Sym)
+    {
+      errs() << "warning: cannot compile loop: " << toString(Sym.takeError()) << "\n";
+      return false;
+    }
+    Fn = jitTargetAddressToFunction<void (*)(int32_t *)>(Sym->getAddress());
+  }
+  Fn(Regs);
+  return true;
+}
@@ -0,0 +1,30 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "AST.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include <memory>
+
+class CodeGen;
+
+// LoopJIT compiles single loops of a program run by the interpreter to native code
+// with ORC, for -tiered. The compiled loop works on the interpreter's registers.
+class LoopJIT
+{
+  CodeGen &CG;
+  std::unique_ptr<llvm::orc::LLJIT> JIT;
+  unsigned NextLoop = 0;
+
+  LoopJIT(CodeGen &CG, std::unique_ptr<llvm::orc::LLJIT> JIT) : CG(CG), JIT(std::move(JIT)) {}
+
+public:
+  // nullptr, after a diagnostic, if there is no JIT for the host
+  static std::unique_ptr<LoopJIT> create(CodeGen &CG);
+
+  // compile Node, whose variables are kept at the given registers, and run it from
+  // its condition to the end on Regs; false if it could not be compiled
+  bool run(Loop &Node, llvm::ArrayRef<std::pair<llvm::StringRef, int32_t>> Registers, int32_t *Regs);
+};
+
+#endif
@@ -84,10 +84,6 @@ void Lexer::next(Token &token)
     // check for special characters
     else if (charinfo::isSpecialCharacter(*BufferPtr))
     {
-        const char *end = BufferPtr + 1;
-        while (charinfo::isSpecialCharacter(*end))
-            ++end;
-        llvm::StringRef Name(BufferPtr, end - BufferPtr);
         llvm::StringRef parenName(BufferPtr, BufferPtr + 1 - BufferPtr);
         Token::TokenKind kind;
         bool is_valid = true;
@@ -102,6 +98,12 @@ void Lexer::next(Token &token)
             formToken(token, BufferPtr + 1, kind);
         }
         else {
+            // parentheses are single tokens, so runs of them are not scanned over
+            // again for every one
+            const char *end = BufferPtr + 1;
+            while (charinfo::isSpecialCharacter(*end))
+                ++end;
+            llvm::StringRef Name(BufferPtr, end - BufferPtr);
             if (Name == "=")
             {
                 kind = Token::equal;
@@ -0,0 +1,313 @@
+#include "LoopAnalysis.h"
+#include <limits>
+
+using namespace llvm;
+
+namespace
+{
+  // literal value of E if it is a number factor
+  Optional<int64_t> getLiteral(Expr *E)
+  {
+    auto *F = dyn_cast_or_null<Factor>(E);
+    int64_t Val;
+    if (!F || F->getKind() != Factor::Number || F->getVal().getAsInteger(10, Val))
+      return None;
+    return Val;
+  }
+
+  bool isIdent(Expr *E, StringRef Var)
+  {
+    auto *F = dyn_cast_or_null<Factor>(E);
+    return F && F->getKind() == Factor::Ident && F->getVal() == Var;
+  }
+
+  // operator of "R op L" equivalent to "L op R"
+  BinaryOp::Operator swapPredicate(BinaryOp::Operator Op)
+  {
+    switch (Op)
+    {
+    case BinaryOp::Gr:
+      return BinaryOp::Lo;
+    case BinaryOp::Lo:
+      return BinaryOp::Gr;
+    case BinaryOp::GrEq:
+      return BinaryOp::LoEq;
+    case BinaryOp::LoEq:
+      return BinaryOp::GrEq;
+    default:
+      return Op;
+    }
+  }
+
+  // true if evaluating E may trap, e.g. a division by a non-constant or zero divisor
+  bool mayTrap(Expr *E)
+  {
+    if (isStackNearlyExhausted())
+      return runOnNewStack([&] { return mayTrap(E); });
+    auto *B = dyn_cast_or_null<BinaryOp>(E);
+    if (!B)
+      return false;
+    if (B->getOperator() == BinaryOp::Div || B->getOperator() == BinaryOp::Mod)
+    {
+      Optional<int64_t> Divisor = getLiteral(B->getRight());
+      if (!Divisor || *Divisor == 0)
+        return true;
+    }
+    return mayTrap(B->getLeft()) || mayTrap(B->getRight());
+  }
+}
+
+LoopAnalysis::LoopAnalysis(Loop &L) : L(L)
+{
+  for (auto I = L.begin(), E = L.end(); I != E; ++I)
+  {
+    ++AssignCount[(*I)->getLeft()->getVal()];
+    ++BodySize;
+  }
+  findInduction();
+  findRecurrences();
+}
+
+bool LoopAnalysis::isSafeInvariant(Expr *E)
+{
+  return isInvariant(E) && !mayTrap(E);
+}
+
+int LoopAnalysis::getPosition(StringRef Var)
+{
+  auto I = Position.find(Var);
+  return I == Position.end() ? -1 : int(I->getValue());
+}
+
+bool LoopAnalysis::isInvariant(Expr *E)
+{
+  if (isStackNearlyExhausted())
+    return runOnNewStack([&] { return isInvariant(E); });
+  if (auto *F = dyn_cast_or_null<Factor>(E))
+    return F->getKind() == Factor::Number || !isAssigned(F->getVal());
+  if (auto *B = dyn_cast_or_null<BinaryOp>(E))
+    return isInvariant(B->getLeft()) && isInvariant(B->getRight());
+  return false;
+}
+
+void LoopAnalysis::collectHoistable(SmallVectorImpl<BinaryOp *> &Hoistable)
+{
+  SmallVector<Expr *> Worklist;
+  Worklist.push_back(L.getCondition());
+  for (auto I = L.begin(), E = L.end(); I != E; ++I)
+    Worklist.push_back((*I)->getRight());
+
+  while (!Worklist.empty())
+  {
+    auto *B = dyn_cast_or_null<BinaryOp>(Worklist.pop_back_val());
+    if (!B)
+      continue;
+    if (isInvariant(B) && !mayTrap(B))
+    {
+      Hoistable.push_back(B);
+      continue;
+    }
+    Worklist.push_back(B->getLeft());
+    Worklist.push_back(B->getRight());
+  }
+}
+
+// an induction variable is assigned exactly once in the body with "+=" or "-=" of a
+// literal and is compared against a loop-invariant bound in the condition
+void LoopAnalysis::findInduction()
+{
+  auto *Cond = dyn_cast_or_null<BinaryOp>(L.getCondition());
+  if (!Cond)
+    return;
+
+  switch (Cond->getOperator())
+  {
+  case BinaryOp::Gr:
+  case BinaryOp::Lo:
+  case BinaryOp::GrEq:
+  case BinaryOp::LoEq:
+  case BinaryOp::IsNEq:
+    break;
+  default:
+    return;
+  }
+
+  for (auto I = L.begin(), E = L.end(); I != E; ++I)
+  {
+    Assignment *A = *I;
+    StringRef Var = A->getLeft()->getVal();
+    if (AssignCount[Var] != 1)
+      continue;
+    if (A->getOperator() != Assignment::PlEq && A->getOperator() != Assignment::MinEq)
+      continue;
+    Optional<int64_t> Inc = getLiteral(A->getRight());
+    if (!Inc || *Inc == 0)
+      continue;
+
+    if (isIdent(Cond->getLeft(), Var) && isInvariant(Cond->getRight()))
+    {
+      Pred = Cond->getOperator();
+      Bound = Cond->getRight();
+    }
+    else if (isIdent(Cond->getRight(), Var) && isInvariant(Cond->getLeft()))
+    {
+      Pred = swapPredicate(Cond->getOperator());
+      Bound = Cond->getLeft();
+    }
+    else
+      continue;
+
+    IndVar = Var;
+    Step = A->getOperator() == Assignment::PlEq ? *Inc : -*Inc;
+    return;
+  }
+}
+
+Optional<uint64_t> LoopAnalysis::getTripCount(int64_t Start, int64_t BoundVal)
+{
+  if (!hasInduction())
+    return None;
+
+  int64_t Distance = BoundVal - Start;
+  int64_t Trips;
+  switch (Pred)
+  {
+  case BinaryOp::Lo:
+    if (Distance <= 0)
+      return 0;
+    if (Step < 0)
+      return None;
+    Trips = (Distance + Step - 1) / Step;
+    break;
+  case BinaryOp::LoEq:
+    if (Distance < 0)
+      return 0;
+    if (Step < 0)
+      return None;
+    Trips = Distance / Step + 1;
+    break;
+  case BinaryOp::Gr:
+    if (Distance >= 0)
+      return 0;
+    if (Step > 0)
+      return None;
+    Trips = (Distance + Step + 1) / Step;
+    break;
+  case BinaryOp::GrEq:
+    if (Distance > 0)
+      return 0;
+    if (Step > 0)
+      return None;
+    Trips = Distance / Step + 1;
+    break;
+  case BinaryOp::IsNEq:
+    if (Distance % Step != 0 || Distance / Step < 0)
+      return None;
+    Trips = Distance / Step;
+    break;
+  default:
+    return None;
+  }
+
+  // the last value of the induction variable must still fit in i32
+  int64_t Last = Start + Trips * Step;
+  if (Last < std::numeric_limits<int32_t>::min() || Last > std::numeric_limits<int32_t>::max())
+    return None;
+  return Trips;
+}
+
+// Reading a variable at position Pos of the body gives, in iteration k: its value
+// before the loop if the body does not assign it, the value assigned in iteration k
+// if its assignment comes earlier, or its value at the start of iteration k if it
+// comes later. The latter is only a polynomial for accumulators.
+void LoopAnalysis::findRecurrences()
+{
+  if (!hasInduction() || BodySize != AssignCount.size())
+    return;
+  bool CountsUp = Pred == BinaryOp::Lo || Pred == BinaryOp::LoEq;
+  bool CountsDown = Pred == BinaryOp::Gr || Pred == BinaryOp::GrEq;
+  if (!(CountsUp && Step > 0) && !(CountsDown && Step < 0))
+    return;
+
+  for (auto I = L.begin(), E = L.end(); I != E; ++I)
+  {
+    Assignment::Operator Op = (*I)->getOperator();
+    if (Op != Assignment::Eq && Op != Assignment::PlEq && Op != Assignment::MinEq)
+      return;
+    Position[(*I)->getLeft()->getVal()] = Body.size();
+    Body.push_back(*I);
+  }
+
+  StartDegrees.assign(Body.size(), -2);
+  for (unsigned Pos = 0; Pos < Body.size(); ++Pos)
+    if (!getAfterDegree(Pos))
+      return;
+  ClosedForm = true;
+}
+
+// degree of E evaluated at position Pos, or None if it is not a polynomial
+Optional<unsigned> LoopAnalysis::getDegree(Expr *E, unsigned Pos)
+{
+  if (isStackNearlyExhausted())
+    return runOnNewStack([&] { return getDegree(E, Pos); });
+  if (isSafeInvariant(E))
+    return 0;
+
+  // a variable that is not invariant is assigned in the body
+  if (auto *F = dyn_cast<Factor>(E))
+  {
+    unsigned Assigned = Position.lookup(F->getVal());
+    if (Assigned < Pos)
+      return getAfterDegree(Assigned);
+    if (Assigned > Pos && Body[Assigned]->getOperator() != Assignment::Eq)
+      return getStartDegree(Assigned);
+    return None;
+  }
+
+  auto *B = cast<BinaryOp>(E);
+  Optional<unsigned> Left = getDegree(B->getLeft(), Pos);
+  if (!Left)
+    return None;
+  if (B->getOperator() == BinaryOp::Shl && getLiteral(B->getRight()))
+    return Left;
+  Optional<unsigned> Right = getDegree(B->getRight(), Pos);
+  if (!Right)
+    return None;
+
+  switch (B->getOperator())
+  {
+  case BinaryOp::Plus:
+  case BinaryOp::Minus:
+    return std::max(*Left, *Right);
+  case BinaryOp::Mul:
+    if (*Left + *Right > MaxDegree)
+      return None;
+    return *Left + *Right;
+  default:
+    return None;
+  }
+}
+
+// an accumulator sums its increments, which raises their degree by one
+Optional<unsigned> LoopAnalysis::getStartDegree(unsigned Pos)
+{
+  int &Degree = StartDegrees[Pos];
+  if (Degree == -1)
+    return None; // the recurrence depends on itself, e.g. a Fibonacci sequence
+  if (Degree == -2)
+  {
+    Degree = -1;
+    Optional<unsigned> Increment = getDegree(Body[Pos]->getRight(), Pos);
+    if (!Increment || *Increment + 1 > MaxDegree)
+      return None;
+    StartDegrees[Pos] = *Increment + 1;
+  }
+  return unsigned(StartDegrees[Pos]);
+}
+
+Optional<unsigned> LoopAnalysis::getAfterDegree(unsigned Pos)
+{
+  if (Body[Pos]->getOperator() == Assignment::Eq)
+    return getDegree(Body[Pos]->getRight(), Pos);
+  return getStartDegree(Pos);
+}
@@ -0,0 +1,84 @@
+#ifndef LOOPANALYSIS_H
+#define LOOPANALYSIS_H
+
+#include "AST.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringMap.h"
+
+// LoopAnalysis summarizes a loopc statement on the AST: which variables the body
+// assigns, its induction variable and, given the start value, its trip count
+class LoopAnalysis
+{
+  Loop &L;
+  llvm::StringMap<unsigned> AssignCount; // number of assignments to each variable in the body
+  unsigned BodySize = 0;                 // number of assignments in the body
+
+  llvm::StringRef IndVar; // induction variable, empty if none was found
+  int64_t Step = 0;       // constant added to IndVar on every iteration
+  BinaryOp::Operator Pred; // comparison of the condition, normalized to "IndVar Pred Bound"
+  Expr *Bound = nullptr;   // loop-invariant right-hand side of the condition
+
+  // closed forms, see findRecurrences
+  bool ClosedForm = false;
+  llvm::StringMap<unsigned> Position;        // index of the assignment to each variable
+  llvm::SmallVector<Assignment *> Body;      // the assignments of the body
+  llvm::SmallVector<int> StartDegrees;       // memoized, -1 while being computed
+
+  void findInduction();
+  void findRecurrences();
+  llvm::Optional<unsigned> getDegree(Expr *E, unsigned Pos);
+  llvm::Optional<unsigned> getStartDegree(unsigned Pos);
+  llvm::Optional<unsigned> getAfterDegree(unsigned Pos);
+
+public:
+  // highest degree of the polynomials in a closed form
+  static const unsigned MaxDegree = 4;
+
+  LoopAnalysis(Loop &L);
+
+  bool isAssigned(llvm::StringRef Var) { return AssignCount.count(Var); }
+
+  llvm::StringMap<unsigned>::const_iterator beginAssigned() { return AssignCount.begin(); }
+
+  llvm::StringMap<unsigned>::const_iterator endAssigned() { return AssignCount.end(); }
+
+  unsigned getBodySize() { return BodySize; }
+
+  // an expression is invariant if it reads no variable assigned in the body
+  bool isInvariant(Expr *E);
+
+  // collects the largest invariant BinaryOp subtrees of the condition and the body
+  // that are safe to evaluate once before the loop (they cannot trap)
+  void collectHoistable(llvm::SmallVectorImpl<BinaryOp *> &Hoistable);
+
+  bool hasInduction() { return !IndVar.empty(); }
+
+  llvm::StringRef getIndVar() { return IndVar; }
+
+  int64_t getStep() { return Step; }
+
+  Expr *getBound() { return Bound; }
+
+  BinaryOp::Operator getPredicate() { return Pred; }
+
+  // number of iterations when IndVar starts at Start and Bound evaluates to
+  // BoundVal, or None if it is unknown or the induction variable would overflow i32
+  llvm::Optional<uint64_t> getTripCount(int64_t Start, int64_t BoundVal);
+
+  // an invariant expression that cannot trap, so it can be evaluated before the loop
+  bool isSafeInvariant(Expr *E);
+
+  // true if the induction variable counts toward the bound and every variable is
+  // assigned once in the body, by "+=" or "-=" of a polynomial in the iteration
+  // number (an accumulator, the induction variable included) or by "=" of one. The
+  // value of every variable after any number of iterations is then a polynomial of
+  // degree at most MaxDegree in the iteration number.
+  bool hasClosedForm() { return ClosedForm; }
+
+  // index of the assignment to Var in the body, or -1 if the body does not assign it
+  int getPosition(llvm::StringRef Var);
+
+  Assignment *getAssignment(unsigned Pos) { return Body[Pos]; }
+};
+
+#endif
@@ -0,0 +1,559 @@
+#include "Optimizer.h"
+#include "llvm/ADT/APInt.h"
+#include "llvm/Support/DivisionByConstantInfo.h"
+#include "llvm/Support/MathExtras.h"
+#include <climits>
+
+using namespace llvm;
+
+namespace
+{
+  // literal value of E if it is a number factor that fits in i32
+  Optional<int64_t> getLiteralValue(Expr *E)
+  {
+    auto *F = dyn_cast_or_null<Factor>(E);
+    int32_t Val;
+    if (!F || F->getKind() != Factor::Number || F->getVal().getAsInteger(10, Val))
+      return None;
+    return Val;
+  }
+
+  // the dividend of a reduced division is evaluated more than once, so only
+  // small expressions are worth duplicating
+  unsigned getSize(Expr *E)
+  {
+    if (isStackNearlyExhausted())
+      return runOnNewStack([&] { return getSize(E); });
+    if (auto *B = dyn_cast<BinaryOp>(E))
+      return 1 + getSize(B->getLeft()) + getSize(B->getRight());
+    return 1;
+  }
+
+  const unsigned MaxDividendSize = 5;
+
+  int32_t wrap(uint32_t Val) { return static_cast<int32_t>(Val); }
+
+  // Base multiplied by itself Exponent - 1 times, modulo 2^32
+  int32_t power(int32_t Base, int32_t Exponent)
+  {
+    uint32_t Result = Base, Factor = Base;
+    for (uint32_t N = Exponent > 1 ? Exponent - 1 : 0; N; N >>= 1)
+    {
+      if (N & 1)
+        Result *= Factor;
+      Factor *= Factor;
+    }
+    return wrap(Result);
+  }
+
+  // "L Op R" as the program computes it, or None if it traps
+  Optional<int32_t> apply(BinaryOp::Operator Op, int32_t L, int32_t R)
+  {
+    switch (Op)
+    {
+    case BinaryOp::Or:    return L != 0 || R != 0;
+    case BinaryOp::And:   return L != 0 && R != 0;
+    case BinaryOp::IsEq:  return L == R;
+    case BinaryOp::IsNEq: return L != R;
+    case BinaryOp::GrEq:  return L >= R;
+    case BinaryOp::LoEq:  return L <= R;
+    case BinaryOp::Gr:    return L > R;
+    case BinaryOp::Lo:    return L < R;
+    case BinaryOp::Plus:  return wrap(uint32_t(L) + uint32_t(R));
+    case BinaryOp::Minus: return wrap(uint32_t(L) - uint32_t(R));
+    case BinaryOp::Mul:   return wrap(uint32_t(L) * uint32_t(R));
+    case BinaryOp::Div:
+    case BinaryOp::Mod:
+      if (R == 0 || (L == INT32_MIN && R == -1))
+        return None;
+      return Op == BinaryOp::Div ? L / R : L % R;
+    case BinaryOp::Pow:   return power(L, R);
+    default:
+      // the optimizer's own operators come later
+      return None;
+    }
+  }
+}
+
+Factor *StrengthReduction::getLiteral(int64_t Val)
+{
+  return new Factor(Factor::Number, Literals.save(Twine(Val)));
+}
+
+Expr *StrengthReduction::clone(Expr *E)
+{
+  if (isStackNearlyExhausted())
+    return runOnNewStack([&] { return clone(E); });
+  if (auto *F = dyn_cast<Factor>(E))
+    return new Factor(F->getKind(), F->getVal());
+  auto *B = cast<BinaryOp>(E);
+  return new BinaryOp(B->getOperator(), clone(B->getLeft()), clone(B->getRight()));
+}
+
+// x / d for a literal d >= 2, rounding toward zero
+BinaryOp *StrengthReduction::emitSignedDiv(Expr *X, int64_t D)
+{
+  if (isPowerOf2_64(D))
+  {
+    // add 2^k - 1 to negative dividends before the arithmetic shift, so the
+    // quotient is rounded toward zero instead of toward negative infinity
+    unsigned K = Log2_64(D);
+    Expr *Sign = K == 1 ? clone(X) : new BinaryOp(BinaryOp::AShr, clone(X), getLiteral(31));
+    Expr *Bias = new BinaryOp(BinaryOp::LShr, Sign, getLiteral(32 - K));
+    return new BinaryOp(BinaryOp::AShr, new BinaryOp(BinaryOp::Plus, X, Bias), getLiteral(K));
+  }
+
+  // q = mulhi(x, magic) (+ x), shifted, plus one if x is negative
+  SignedDivisionByConstantInfo Magic = SignedDivisionByConstantInfo::get(APInt(32, D));
+  int64_t M = Magic.Magic.getSExtValue();
+  Expr *Q = new BinaryOp(BinaryOp::MulHi, X, getLiteral(M));
+  if (M < 0)
+    Q = new BinaryOp(BinaryOp::Plus, Q, clone(X));
+  if (Magic.ShiftAmount)
+    Q = new BinaryOp(BinaryOp::AShr, Q, getLiteral(Magic.ShiftAmount));
+  return new BinaryOp(BinaryOp::Plus, Q, new BinaryOp(BinaryOp::LShr, clone(X), getLiteral(31)));
+}
+
+// literals are never negative, the language has no unary minus
+BinaryOp *StrengthReduction::reduce(BinaryOp::Operator Op, Expr *X, int64_t D)
+{
+  switch (Op)
+  {
+  case BinaryOp::Mul:
+    if (D < 2 || !isPowerOf2_64(D))
+      return nullptr;
+    return new BinaryOp(BinaryOp::Shl, X, getLiteral(Log2_64(D)));
+
+  case BinaryOp::Div:
+    if (D < 2 || getSize(X) > MaxDividendSize)
+      return nullptr;
+    return emitSignedDiv(X, D);
+
+  case BinaryOp::Mod:
+  {
+    // x % d == x - (x / d) * d
+    if (D < 2 || getSize(X) > MaxDividendSize)
+      return nullptr;
+    Expr *Multiple;
+    if (isPowerOf2_64(D))
+    {
+      // round x toward zero to a multiple of 2^k by masking the biased dividend
+      BinaryOp *Quotient = emitSignedDiv(clone(X), D);
+      Multiple = new BinaryOp(BinaryOp::BitAnd, Quotient->getLeft(), getLiteral(-D));
+      Quotient->setLeft(nullptr);
+      delete Quotient;
+    }
+    else
+      Multiple = new BinaryOp(BinaryOp::Mul, emitSignedDiv(clone(X), D), getLiteral(D));
+    return new BinaryOp(BinaryOp::Minus, X, Multiple);
+  }
+
+  default:
+    return nullptr;
+  }
+}
+
+void StrengthReduction::replace(BinaryOp &Node, BinaryOp *New)
+{
+  Node.setOperator(New->getOperator());
+  Node.setLeft(New->getLeft());
+  Node.setRight(New->getRight());
+  New->setLeft(nullptr);
+  New->setRight(nullptr);
+  delete New;
+}
+
+void StrengthReduction::visit(AP &Node)
+{
+  for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
+    dispatch(*I);
+}
+
+void StrengthReduction::visit(BinaryOp &Node)
+{
+  dispatch(Node.getLeft());
+  dispatch(Node.getRight());
+
+  Expr *X = Node.getLeft();
+  Expr *Literal = Node.getRight();
+  Optional<int64_t> D = getLiteralValue(Literal);
+  if (!D && Node.getOperator() == BinaryOp::Mul)
+  {
+    std::swap(X, Literal);
+    D = getLiteralValue(Literal);
+  }
+  if (!D)
+    return;
+
+  if (BinaryOp *New = reduce(Node.getOperator(), X, *D))
+  {
+    delete Literal;
+    replace(Node, New);
+  }
+}
+
+void StrengthReduction::visit(Assignment &Node)
+{
+  dispatch(Node.getRight());
+
+  Optional<int64_t> D = getLiteralValue(Node.getRight());
+  if (!D)
+    return;
+
+  // "a op= d" becomes "a = a op d"; %= is an unsigned remainder, so only powers
+  // of two are reduced, to a mask
+  Factor *X = new Factor(Factor::Ident, Node.getLeft()->getVal());
+  BinaryOp *New = nullptr;
+  switch (Node.getOperator())
+  {
+  case Assignment::MulEq:
+    New = reduce(BinaryOp::Mul, X, *D);
+    break;
+  case Assignment::DivEq:
+    New = reduce(BinaryOp::Div, X, *D);
+    break;
+  case Assignment::ModEq:
+    if (*D > 0 && isPowerOf2_64(*D))
+      New = new BinaryOp(BinaryOp::BitAnd, X, getLiteral(*D - 1));
+    break;
+  default:
+    break;
+  }
+  if (!New)
+  {
+    delete X;
+    return;
+  }
+
+  delete Node.getRight();
+  Node.setRight(New);
+  Node.setOperator(Assignment::Eq);
+}
+
+void StrengthReduction::visit(Declaration &Node)
+{
+  for (auto I = Node.beginExprs(), E = Node.endExprs(); I != E; ++I)
+    dispatch(*I);
+}
+
+void StrengthReduction::visit(IfElse &Node)
+{
+  for (auto I = Node.beginExprs(), E = Node.endExprs(); I != E; ++I)
+    dispatch(*I);
+  for (auto I = Node.beginAssigns2D(), E = Node.endAssigns2D(); I != E; ++I)
+    for (Assignment *A : *I)
+      dispatch(A);
+}
+
+void StrengthReduction::visit(Loop &Node)
+{
+  dispatch(Node.getCondition());
+  for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
+    dispatch(*I);
+}
+
+Factor *ConstantPropagation::getLiteral(int32_t Val)
+{
+  return new Factor(Factor::Number, Literals.save(Twine(Val)));
+}
+
+bool ConstantPropagation::isDead(StringRef Var)
+{
+  return llvm::find(DeadVars, Var) != DeadVars.end();
+}
+
+Optional<int32_t> ConstantPropagation::evaluate(Expr *E, const State &S, bool Condition)
+{
+  if (isStackNearlyExhausted())
+    return runOnNewStack([&] { return evaluate(E, S, Condition); });
+  if (auto *F = dyn_cast<Factor>(E))
+  {
+    if (F->getKind() == Factor::Number)
+    {
+      Optional<int64_t> Val = getLiteralValue(F);
+      return Val ? Optional<int32_t>(*Val) : None;
+    }
+    auto I = S.find(F->getVal());
+    return I == S.end() ? None : Optional<int32_t>(I->getValue());
+  }
+
+  auto *B = cast<BinaryOp>(E);
+  BinaryOp::Operator Op = B->getOperator();
+  bool ShortCircuit = Condition && (Op == BinaryOp::And || Op == BinaryOp::Or);
+  Optional<int32_t> L = evaluate(B->getLeft(), S, ShortCircuit);
+  if (ShortCircuit && L && (*L != 0) == (Op == BinaryOp::Or))
+    return *L != 0;
+  Optional<int32_t> R = evaluate(B->getRight(), S, ShortCircuit);
+  if (!L || !R)
+    return None;
+  return apply(Op, *L, *R);
+}
+
+Expr *ConstantPropagation::fold(Expr *E, const State &S, bool Condition)
+{
+  if (isStackNearlyExhausted())
+    return runOnNewStack([&] { return fold(E, S, Condition); });
+  if (auto *F = dyn_cast<Factor>(E))
+  {
+    if (F->getKind() == Factor::Number)
+      return F;
+    auto I = S.find(F->getVal());
+    if (I == S.end())
+      return F;
+    delete F;
+    return getLiteral(I->getValue());
+  }
+
+  auto *B = cast<BinaryOp>(E);
+  BinaryOp::Operator Op = B->getOperator();
+  bool ShortCircuit = Condition && (Op == BinaryOp::And || Op == BinaryOp::Or);
+  B->setLeft(fold(B->getLeft(), S, ShortCircuit));
+  B->setRight(fold(B->getRight(), S, ShortCircuit));
+
+  Optional<int64_t> L = getLiteralValue(B->getLeft());
+  Optional<int64_t> R = getLiteralValue(B->getRight());
+  Optional<int32_t> Val;
+  if (ShortCircuit && L && (*L != 0) == (Op == BinaryOp::Or))
+    Val = *L != 0;
+  else if (L && R)
+    Val = apply(Op, *L, *R);
+  if (!Val)
+    return B;
+  delete B;
+  return getLiteral(*Val);
+}
+
+void ConstantPropagation::transfer(Assignment &A, State &S, bool Rewrite)
+{
+  // code generation skips these, the variable keeps its value
+  StringRef Var = A.getLeft()->getVal();
+  if (DeadStores.count(A.getId()) || isDead(Var))
+    return;
+
+  Optional<int32_t> Val;
+  if (Rewrite)
+  {
+    A.setRight(fold(A.getRight(), S, false));
+    Optional<int64_t> Literal = getLiteralValue(A.getRight());
+    if (Literal)
+      Val = *Literal;
+  }
+  else
+    Val = evaluate(A.getRight(), S, false);
+
+  Optional<int32_t> New;
+  auto Old = S.find(Var);
+  if (Val && A.getOperator() == Assignment::Eq)
+    New = Val;
+  else if (Val && Old != S.end())
+  {
+    int32_t L = Old->getValue();
+    switch (A.getOperator())
+    {
+    case Assignment::PlEq:
+      New = apply(BinaryOp::Plus, L, *Val);
+      break;
+    case Assignment::MinEq:
+      New = apply(BinaryOp::Minus, L, *Val);
+      break;
+    case Assignment::MulEq:
+      New = apply(BinaryOp::Mul, L, *Val);
+      break;
+    case Assignment::DivEq:
+      New = apply(BinaryOp::Div, L, *Val);
+      break;
+    case Assignment::ModEq:
+      // an unsigned remainder
+      if (*Val)
+        New = wrap(uint32_t(L) % uint32_t(*Val));
+      break;
+    case Assignment::Eq:
+      break;
+    }
+  }
+
+  if (!New)
+  {
+    S.erase(Var);
+    return;
+  }
+  if (Rewrite && A.getOperator() != Assignment::Eq)
+  {
+    delete A.getRight();
+    A.setRight(getLiteral(*New));
+    A.setOperator(Assignment::Eq);
+  }
+  S[Var] = *New;
+}
+
+void ConstantPropagation::join(State &S, const State &Other)
+{
+  SmallVector<StringRef> Unknown;
+  for (auto &Entry : S)
+  {
+    auto I = Other.find(Entry.getKey());
+    if (I == Other.end() || I->getValue() != Entry.getValue())
+      Unknown.push_back(Entry.getKey());
+  }
+  for (StringRef Var : Unknown)
+    S.erase(Var);
+}
+
+void ConstantPropagation::visit(AP &Node)
+{
+  SmallVector<Expr *> Result;
+  Statements = &Result;
+  for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
+    dispatch(*I);
+  Node.setExprs(Result);
+}
+
+void ConstantPropagation::visit(Assignment &Node)
+{
+  transfer(Node, Known, true);
+  Statements->push_back(&Node);
+}
+
+void ConstantPropagation::visit(Declaration &Node)
+{
+  Statements->push_back(&Node);
+
+  // the declaration goes away with its first variable if that is dead
+  if (isDead(*Node.beginVars()))
+  {
+    for (auto I = Node.beginVars(), E = Node.endVars(); I != E; ++I)
+      Known.erase(*I);
+    return;
+  }
+
+  size_t NumExprs = std::distance(Node.beginExprs(), Node.endExprs());
+  size_t Index = 0;
+  for (auto I = Node.beginVars(), E = Node.endVars(); I != E; ++I, ++Index)
+  {
+    StringRef Var = *I;
+    // external variables are read from the input, their initializers are ignored
+    if (isDead(Var) || llvm::find(Inputs, Var) != Inputs.end())
+    {
+      Known.erase(Var);
+      continue;
+    }
+    if (Index >= NumExprs)
+    {
+      Known[Var] = 0;
+      continue;
+    }
+
+    Expr *Init = fold(*(Node.beginExprs() + Index), Known, false);
+    Node.setExpr(Index, Init);
+    Optional<int64_t> Val = getLiteralValue(Init);
+    if (Val)
+      Known[Var] = *Val;
+    else
+      Known.erase(Var);
+  }
+}
+
+void ConstantPropagation::visit(IfElse &Node)
+{
+  // the node gives up its arms and gets back those that can run
+  SmallVector<Expr *> Conditions(Node.beginExprs(), Node.endExprs());
+  SmallVector<SmallVector<Assignment *>> Arms(Node.beginAssigns2D(), Node.endAssigns2D());
+  bool HasElse = Node.getHasElse();
+  Node.setArms({}, {}, false);
+
+  SmallVector<Expr *> NewConditions;
+  SmallVector<SmallVector<Assignment *>> NewArms;
+  bool AlwaysTaken = false;
+  Optional<State> After; // joined from the ends of the arms that can run
+  auto RunArm = [&](SmallVector<Assignment *> &Arm) {
+    State S = Known;
+    for (Assignment *A : Arm)
+      transfer(*A, S, true);
+    if (After)
+      join(*After, S);
+    else
+      After = std::move(S);
+    NewArms.push_back(Arm);
+  };
+
+  size_t I = 0;
+  for (; I < Conditions.size() && !AlwaysTaken; ++I)
+  {
+    Expr *Condition = fold(Conditions[I], Known, true);
+    Optional<int64_t> Val = getLiteralValue(Condition);
+    if (Val && !*Val)
+    {
+      delete Condition;
+      for (Assignment *A : Arms[I])
+        delete A;
+      continue;
+    }
+    // an arm taken whenever it is reached ends the statement as its else arm
+    if (Val)
+    {
+      delete Condition;
+      AlwaysTaken = true;
+    }
+    else
+      NewConditions.push_back(Condition);
+    RunArm(Arms[I]);
+  }
+
+  // the arms after one always taken never run
+  for (size_t J = I; J < Conditions.size(); ++J)
+    delete Conditions[J];
+  if (AlwaysTaken)
+    for (size_t J = I; J < Arms.size(); ++J)
+      for (Assignment *A : Arms[J])
+        delete A;
+
+  if (!AlwaysTaken && HasElse)
+    RunArm(Arms.back());
+  else if (!AlwaysTaken && After)
+    join(*After, Known);
+  if (After)
+    Known = std::move(*After);
+  HasElse = HasElse || AlwaysTaken;
+
+  if (!NewConditions.empty())
+  {
+    Node.setArms(NewConditions, NewArms, HasElse);
+    Statements->push_back(&Node);
+    return;
+  }
+  // no condition left to test: the else arm runs unconditionally, if there is one
+  if (HasElse)
+    Statements->append(NewArms.back().begin(), NewArms.back().end());
+  delete &Node;
+}
+
+void ConstantPropagation::visit(Loop &Node)
+{
+  Optional<int32_t> Entry = evaluate(Node.getCondition(), Known, true);
+  if (Entry && !*Entry)
+  {
+    delete &Node;
+    return;
+  }
+
+  // the state at the condition holds the values that entering the loop and every
+  // iteration agree on; values are only ever dropped, so this terminates
+  State Head = Known;
+  for (;;)
+  {
+    State S = Head;
+    for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
+      transfer(**I, S, false);
+    size_t Size = Head.size();
+    join(Head, S);
+    if (Head.size() == Size)
+      break;
+  }
+
+  State S = Head;
+  for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
+    transfer(**I, S, true);
+  Node.setCondition(fold(Node.getCondition(), Head, true));
+  Known = std::move(Head);
+  Statements->push_back(&Node);
+}
@@ -0,0 +1,110 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "AST.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/StringSaver.h"
+#include <cstdint>
+
+// StrengthReduction rewrites multiplications, divisions and modulos by literal
+// constants in place: powers of two become shifts and masks, other divisors a
+// multiply-high sequence. The rewritten tree computes exactly what the original
+// did, including the rounding toward zero of signed division.
+class StrengthReduction : public StaticASTVisitor<StrengthReduction>
+{
+  llvm::BumpPtrAllocator Alloc;
+  llvm::StringSaver Literals; // text of the literals created by the rewrites
+
+  Factor *getLiteral(int64_t Val);
+  Expr *clone(Expr *E);
+
+  // expression equivalent to "X Op D", taking ownership of X, or nullptr (and X is
+  // left alone) if it cannot be reduced
+  BinaryOp *reduce(BinaryOp::Operator Op, Expr *X, int64_t D);
+  BinaryOp *emitSignedDiv(Expr *X, int64_t D);
+
+  // the node takes over the operator and operands of New, which is deleted
+  void replace(BinaryOp &Node, BinaryOp *New);
+
+public:
+  StrengthReduction() : Literals(Alloc) {}
+
+  // literals created by the rewrites live as long as this object
+  void run(AST *Tree) { dispatch(Tree); }
+
+  void visit(AP &Node);
+  void visit(Factor &) {}
+  void visit(BinaryOp &Node);
+  void visit(Assignment &Node);
+  void visit(Declaration &Node);
+  void visit(IfElse &Node);
+  void visit(Loop &Node);
+};
+
+// ConstantPropagation follows the values of variables known at compile time
+// through the program, along the if arms and loops that can run. Reads of known
+// variables become literals and operations on literals are folded. Arms whose
+// condition is known to be false are removed, an if whose taken arm is known is
+// replaced by that arm's assignments, and loops whose condition is false on entry
+// are removed. Operations that would trap at run time are left alone, and so are
+// dead variables, dead stores and external variables: code generation treats
+// them specially.
+class ConstantPropagation : public StaticASTVisitor<ConstantPropagation>
+{
+  using State = llvm::StringMap<int32_t>; // the variables whose value is known
+
+  llvm::ArrayRef<llvm::StringRef> DeadVars;
+  const llvm::DenseMap<unsigned, llvm::StringRef> &DeadStores;
+  llvm::ArrayRef<llvm::StringRef> Inputs;
+
+  State Known; // at the statement being visited
+  llvm::SmallVectorImpl<Expr *> *Statements = nullptr; // replacing the one visited
+
+  llvm::BumpPtrAllocator Alloc;
+  llvm::StringSaver Literals; // text of the literals created by the rewrites
+
+  Factor *getLiteral(int32_t Val);
+  bool isDead(llvm::StringRef Var);
+
+  // value of E in S, or None if it is unknown or traps; in a condition, "and" and
+  // "or" only evaluate their right-hand side if the left-hand side does not decide
+  llvm::Optional<int32_t> evaluate(Expr *E, const State &S, bool Condition);
+  // E with the known variables of S replaced by literals and folded, taking
+  // ownership of E
+  Expr *fold(Expr *E, const State &S, bool Condition);
+  // update S for an assignment, rewriting it if Rewrite is set
+  void transfer(Assignment &A, State &S, bool Rewrite);
+  // keep the values of S that Other agrees on
+  static void join(State &S, const State &Other);
+
+public:
+  ConstantPropagation(llvm::ArrayRef<llvm::StringRef> DeadVars,
+                      const llvm::DenseMap<unsigned, llvm::StringRef> &DeadStores,
+                      llvm::ArrayRef<llvm::StringRef> Inputs)
+      : DeadVars(DeadVars), DeadStores(DeadStores), Inputs(Inputs), Literals(Alloc) {}
+
+  // literals created by the rewrites live as long as this object
+  void run(AP &Tree) { dispatch(Tree); }
+
+  // the same for the statements of a program one at a time, in order: appends the
+  // statements replacing Statement to Result, which takes ownership of them
+  void run(Expr *Statement, llvm::SmallVectorImpl<Expr *> &Result)
+  {
+    Statements = &Result;
+    dispatch(Statement);
+  }
+
+  void visit(AP &Node);
+  void visit(Factor &) {}
+  void visit(BinaryOp &) {}
+  void visit(Assignment &Node);
+  void visit(Declaration &Node);
+  void visit(IfElse &Node);
+  void visit(Loop &Node);
+};
+
+#endif
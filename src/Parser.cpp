@@ -1,5 +1,16 @@
 #include "Parser.h"
 
+namespace
+{
+    // frees the nodes of a statement abandoned on a syntax error
+    template <typename T> void deleteAll(llvm::SmallVectorImpl<T *> &Nodes)
+    {
+        for (T *Node : Nodes)
+            delete Node;
+        Nodes.clear();
+    }
+}
+
 // main point is that the whole input has been consumed
 AST *Parser::parse()
 {
@@ -10,82 +21,137 @@ AST *Parser::parse()
 AST *Parser::parseAP()
 {
     llvm::SmallVector<Expr *> exprs;
+    while (Expr *statement = parseNext())
+        exprs.push_back(statement);
+
+    if (HasError)
+    {
+        deleteAll(exprs);
+        return nullptr;
+    }
+    return new AP(exprs);
+}
+
+// returns the next top-level statement, or nullptr once the input is exhausted or
+// too many errors were reported
+Expr *Parser::parseNext()
+{
     while (!Tok.is(Token::eoi))
     {
-        switch (Tok.getKind())
+        // if and loopc statements are resynchronized at their closing "end"
+        bool compound = Tok.isOneOf(Token::KW_if, Token::KW_loopc);
+        Expr *statement = parseStatement();
+
+        if (statement && !Recovering)
         {
-        case Token::KW_int:
-            Expr *declaration;
-            declaration = parseDeclaration();
-
-            if (declaration)
-                exprs.push_back(declaration);
-            else
-                goto _error1;
-            
-            if (!Tok.is(Token::semicolon))
-            {
-                error();
-                goto _error1;
-            }
-            break;
-
-        case Token::ident:
-            Expr *assign;
-            assign = parseAssign();
-
-            if (!Tok.is(Token::semicolon))
-            {
-                error();
-                goto _error1;
-            }
-
-            if (assign)
-                exprs.push_back(assign);
-            else
-                goto _error1;
-            break;
-
-        case Token::KW_if:
-            Expr *ifelse;
-            ifelse = parseIfElse();
-
-            if (ifelse)
-                exprs.push_back(ifelse);
-            else
-                goto _error1;
-            break;
-
-        case Token::KW_loopc:
-            Expr *loop;
-            loop = parseLoop();
-
-            if (!Tok.is(Token::KW_end))
-            {
-                error();
-                goto _error1;
-            }
-
-            if (loop)
-                exprs.push_back(loop);
-            else
-                goto _error1;
-            break;
-
-        default:
-            goto _error1;
-            break;
+            advance();
+            return statement;
         }
+        // a statement parsed while recovering is incomplete
+        delete statement;
 
-        advance();
+        // panic mode: report, resynchronize at the next ";" or "end" and go on
+        error();
+        if (tooManyErrors())
+        {
+            llvm::errs() << "Too many errors, stopping\n";
+            while (Tok.getKind() != Token::eoi)
+                advance();
+            return nullptr;
+        }
+        recover();
+        while (compound && !Tok.isOneOf(Token::KW_end, Token::eoi))
+        {
+            advance();
+            recover();
+        }
+        if (!Tok.is(Token::eoi))
+            advance();
+
+        // skip the remaining arms of an if statement whose header was broken
+        while (Tok.isOneOf(Token::KW_elif, Token::KW_else))
+        {
+            while (!Tok.isOneOf(Token::KW_end, Token::eoi))
+                advance();
+            if (!Tok.is(Token::eoi))
+                advance();
+        }
     }
-    return new AP(exprs);
-_error1:
-    while (Tok.getKind() != Token::eoi)
-        advance();
     return nullptr;
 }
 
+// parses a single top-level statement, leaving Tok at its terminating ";" or "end"
+Expr *Parser::parseStatement()
+{
+    switch (Tok.getKind())
+    {
+    case Token::KW_int:
+        return parseDeclaration();
+
+    case Token::ident:
+        Assignment *assign;
+        assign = parseAssign();
+
+        if (expect(Token::semicolon))
+        {
+            delete assign;
+            return nullptr;
+        }
+        return assign;
+
+    case Token::KW_if:
+        return parseIfElse();
+
+    case Token::KW_loopc:
+        return parseLoop();
+
+    default:
+        error();
+        return nullptr;
+    }
+}
+
+// parses ":" "begin" (<Assign>)* "end", leaving Tok at "end"; a broken
+// assignment is skipped up to the next ";" so the rest of the block is still checked.
+// Returns true on an error, after deleting the assignments of Assigns
+bool Parser::parseBlock(llvm::SmallVector<Assignment *> &Assigns)
+{
+    if (consume(Token::colon) || consume(Token::KW_begin))
+        return true;
+
+    while (!Tok.isOneOf(Token::KW_end, Token::eoi))
+    {
+        Assignment *A = nullptr;
+        if (Tok.is(Token::ident))
+            A = parseAssign();
+
+        if (A && !Recovering && !expect(Token::semicolon))
+        {
+            Assigns.push_back(A);
+            advance();
+            continue;
+        }
+        delete A;
+
+        error();
+        if (tooManyErrors())
+        {
+            deleteAll(Assigns);
+            return true;
+        }
+        recover();
+        if (Tok.is(Token::semicolon))
+            advance();
+    }
+
+    if (expect(Token::KW_end))
+    {
+        deleteAll(Assigns);
+        return true;
+    }
+    return false;
+}
+
 Expr *Parser::parseDeclaration()
 {
     Expr *E;
@@ -94,16 +160,13 @@ Expr *Parser::parseDeclaration()
     llvm::SmallVector<llvm::StringRef, 8> Vars;
     llvm::SmallVector<Expr *> Exprs;
 
-    if (!Tok.is(Token::KW_int)){
-        goto _error2;
-    }
+    if (expect(Token::KW_int))
+        return nullptr;
 
     advance();
 
-    if (expect(Token::ident)){
-        error();
-        goto _error2;
-    }
+    if (expect(Token::ident))
+        return nullptr;
 
     Vars.push_back(Tok.getText());
     vars_count += 1;
@@ -113,9 +176,8 @@ Expr *Parser::parseDeclaration()
     {
         advance();
 
-        if (expect(Token::ident)){
-            goto _error2;
-        }
+        if (expect(Token::ident))
+            return nullptr;
 
         Vars.push_back(Tok.getText());
         vars_count += 1;
@@ -139,15 +201,14 @@ Expr *Parser::parseDeclaration()
         }
     }
 
-    if (expect(Token::semicolon) || exprs_count > vars_count){
-        goto _error2;
+    if (expect(Token::semicolon) || exprs_count > vars_count)
+    {
+        error();
+        deleteAll(Exprs);
+        return nullptr;
     }
 
     return new Declaration(Vars, Exprs);
-_error2:
-    while (Tok.getKind() != Token::eoi)
-        advance();
-    return nullptr;
 }
 
 Assignment *Parser::parseAssign()
@@ -177,235 +238,159 @@ Assignment *Parser::parseAssign()
     }
     else{
         error();
+        delete F;
         return nullptr;
     }
 
     advance();
     E = parseExpression();
-    return new Assignment(Op, F, E);
+    return new Assignment(Op, F, E, ++NumAssignments);
 }
 
 Expr *Parser::parseIfElse()
 {
     Expr *E;
-    Assignment *A;
 
     llvm::SmallVector<Expr *> expressions;
     llvm::SmallVector<llvm::SmallVector<Assignment *>> assignments;
     llvm::SmallVector<Assignment *> temp_assignments;
     bool hasElse = false;
 
+    // frees the arms parsed so far, parseBlock already freed the broken one
+    auto discard = [&]() -> Expr * {
+        deleteAll(expressions);
+        for (llvm::SmallVector<Assignment *> &Arm : assignments)
+            deleteAll(Arm);
+        return nullptr;
+    };
+
     if (expect(Token::KW_if))
-        error();
+        return nullptr;
 
     advance();
 
     E = parseExpression();
     expressions.push_back(E);
-    
-
-    if (expect(Token::colon))
-        error();
-
-    advance();
-
-    if (expect(Token::KW_begin))
-        error();
 
-    advance();
-
-    while (!Tok.is(Token::KW_end)){
-        if(Tok.is(Token::ident)){
-            A = parseAssign();
-
-            if (!Tok.is(Token::semicolon))
-            {
-                error();
-            }
-            advance();
-            if(A)
-                temp_assignments.push_back(A);
-            else
-                error();
-        }else{
-            error();
-        }
-    }
+    if (parseBlock(temp_assignments))
+        return discard();
     assignments.push_back(temp_assignments);
 
-    if (expect(Token::KW_end))
+    // Tok stays on "end" unless another arm follows
+    while (peek().is(Token::KW_elif))
     {
-        error();
-    }
-
-    if (peek().is(Token::KW_elif)) {
         advance();
-    }
-    
-    while (Tok.is(Token::KW_elif)) {
         advance();
 
         E = parseExpression();
         expressions.push_back(E);
-        
-        if (expect(Token::colon))
-            error();
-        advance();
-
-        if (expect(Token::KW_begin))
-            error();
-
-        advance();
 
         temp_assignments.clear();
-        
-        while (!Tok.is(Token::KW_end)){
-            if (Tok.is(Token::ident)) 
-            {
-                A = parseAssign();
-
-                if (!Tok.is(Token::semicolon))
-                {
-                    error();
-                }
-                advance();
-                if (A)
-                    temp_assignments.push_back(A);
-                else
-                    error();
-            } 
-
-            else {
-                error();
-            }
-        }
-
+        if (parseBlock(temp_assignments))
+            return discard();
         assignments.push_back(temp_assignments);
-        if (expect(Token::KW_end))
-        {
-            error();
-        }
-
-        if (peek().is(Token::KW_else)) {
-            advance();
-        }
     }
-    
-    if (Tok.is(Token::KW_else)) {
-        advance();
-        hasElse = true;
-
-        if (expect(Token::colon))
-            error();
 
+    if (peek().is(Token::KW_else))
+    {
         advance();
-
-        if (expect(Token::KW_begin))
-            error();
-
         advance();
-        
-        temp_assignments.clear();
-
-        while (!Tok.is(Token::KW_end)){
-           if (Tok.is(Token::ident)) {
-                A = parseAssign();
-
-                if (!Tok.is(Token::semicolon))
-                {
-                    error();
-                    goto _error3;
-                }
-                advance();
-                if (A)
-                    temp_assignments.push_back(A);
-                else
-                    error();
-            } 
-            else {
-                error();
-            }
-        }
+        hasElse = true;
 
+        temp_assignments.clear();
+        if (parseBlock(temp_assignments))
+            return discard();
         assignments.push_back(temp_assignments);
     }
 
-    if (expect(Token::KW_end)){
-        goto _error3;
-    }
-
     return new IfElse(expressions, assignments, hasElse);
-_error3:
-    while (Tok.getKind() != Token::eoi)
-        advance();
-    return nullptr;
 }
 
 Expr *Parser::parseLoop()
 {
     Expr *E;
-    Assignment *A;
     llvm::SmallVector<Assignment *> assignments;
 
-    if (expect(Token::KW_loopc)){
-        error();
-        goto _error4;
-    }
+    if (expect(Token::KW_loopc))
+        return nullptr;
 
     advance();
 
     E = parseExpression();
 
-    if (expect(Token::colon)){
-        error();
-        goto _error4;
-    }
-
-    advance();
-
-    if (expect(Token::KW_begin)){
-        error();
-        goto _error4;
+    if (parseBlock(assignments))
+    {
+        delete E;
+        return nullptr;
     }
 
-    advance();
+    return new Loop(E, assignments);
+}
 
-    while (!Tok.is(Token::KW_end)){
-        if(Tok.is(Token::ident)){
-            A = parseAssign();
+namespace
+{
+    // binary operator and precedence of every token kind, higher binds tighter; 0
+    // for tokens that are no binary operator. All operators are left associative.
+    struct OperatorTable
+    {
+        unsigned char Precedence[Token::KW_logical_and + 1] = {};
+        BinaryOp::Operator Operators[Token::KW_logical_and + 1] = {};
 
-        if(!Tok.is(Token::semicolon)){
-            error();
-            goto _error4;
-        }
-        advance();
-        if(A){
-            assignments.push_back(A);
+        constexpr void add(Token::TokenKind Kind, BinaryOp::Operator Op, unsigned char Prec)
+        {
+            Precedence[Kind] = Prec;
+            Operators[Kind] = Op;
         }
-        else{
-            error();
-            goto _error4;
+
+        constexpr OperatorTable()
+        {
+            add(Token::KW_logical_or, BinaryOp::Or, 1);
+            add(Token::KW_logical_and, BinaryOp::And, 2);
+            add(Token::is_equal, BinaryOp::IsEq, 3);
+            add(Token::is_not_equal, BinaryOp::IsNEq, 3);
+            add(Token::soft_comp_greater, BinaryOp::GrEq, 4);
+            add(Token::soft_comp_lower, BinaryOp::LoEq, 4);
+            add(Token::hard_comp_greater, BinaryOp::Gr, 5);
+            add(Token::hard_comp_lower, BinaryOp::Lo, 5);
+            add(Token::plus, BinaryOp::Plus, 6);
+            add(Token::minus, BinaryOp::Minus, 6);
+            add(Token::star, BinaryOp::Mul, 7);
+            add(Token::slash, BinaryOp::Div, 7);
+            add(Token::mod, BinaryOp::Mod, 7);
+            add(Token::power, BinaryOp::Pow, 8);
         }
-      }else{
-        error();
-        goto _error4;
-      }
-    }
+    };
 
-    if (expect(Token::KW_end))
-    {
-        error();
-        goto _error4;
-    }
+    constexpr OperatorTable Operators;
+}
 
-    return new Loop(E, assignments);
-_error4:
-    while (Tok.getKind() != Token::eoi)
+Expr *Parser::parseExpression()
+{
+    if (isStackNearlyExhausted())
+        return runOnNewStack([&] { return parseExpression(); });
+    if (PrecedenceClimbing)
+        return parseBinary(1);
+    return parseLogicalOr();
+}
+
+Expr *Parser::parseBinary(unsigned MinPrec)
+{
+    Expr *Left = parseFactor();
+
+    // the right operand takes the operators binding tighter than Op, so the loop
+    // keeps the operators of one precedence left associative
+    while (Operators.Precedence[Tok.getKind()] >= MinPrec)
+    {
+        unsigned Prec = Operators.Precedence[Tok.getKind()];
+        BinaryOp::Operator Op = Operators.Operators[Tok.getKind()];
         advance();
-    return nullptr;
+        Expr *Right = parseBinary(Prec + 1);
+        Left = new BinaryOp(Op, Left, Right);
+    }
+    return Left;
 }
 
-Expr *Parser::parseExpression()
+Expr *Parser::parseLogicalOr()
 {
     Expr *Left = parseDisjunction();
 
@@ -547,14 +532,11 @@ Expr *Parser::parseFactor()
     case Token::l_paren:
         advance();
         Res = parseExpression();
-        if (!consume(Token::r_paren))
-            break;
+        consume(Token::r_paren);
+        break;
     default:
-        if (!Res)
-            error();
-        while (!Tok.isOneOf(Token::r_paren,Token::star,Token::plus,
-        Token::minus,Token::slash,Token::eoi))
-            advance();
+        // the statement is skipped by the recovery in parseAP/parseBlock
+        error();
         break;
     }
     return Res;
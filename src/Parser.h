@@ -10,11 +10,30 @@ class Parser
     Lexer &Lex;    // retrieve the next token from the input
     Token Tok;     // stores the next token
     bool HasError; // indicates if an error was detected
+    bool Recovering; // suppresses follow-up errors until the parser resynchronizes
+    unsigned NumErrors; // number of reported errors
+    unsigned ErrorLimit; // stop parsing after this many errors, 0 means no limit
+    unsigned NumAssignments; // number of assignments parsed so far, used as their ids
+    bool PrecedenceClimbing; // parse expressions with parseBinary instead of the descent
 
     void error()
     {
+        if (Recovering)
+            return;
         llvm::errs() << "Unexpected: " << Tok.getText() << "\n";
         HasError = true;
+        Recovering = true;
+        ++NumErrors;
+    }
+
+    bool tooManyErrors() { return ErrorLimit && NumErrors >= ErrorLimit; }
+
+    // skips tokens up to the next synchronization point (";" or "end")
+    void recover()
+    {
+        while (!Tok.isOneOf(Token::semicolon, Token::KW_end, Token::eoi))
+            advance();
+        Recovering = false;
     }
 
     // retrieves the next token from the lexer.expect()
@@ -24,7 +43,10 @@ class Parser
     // Peeks at the next token without advancing the lexer's position
     Token peek()
     {
-        Token NextToken = Tok;
+        Lexer Saved = Lex;
+        Token NextToken;
+        Lex.next(NextToken);
+        Lex = Saved;
         return NextToken;
     }
 
@@ -48,11 +70,17 @@ class Parser
     }
 
     AST *parseAP();
+    Expr *parseStatement();
+    bool parseBlock(llvm::SmallVector<Assignment *> &Assigns);
     Expr *parseDeclaration();
     Assignment *parseAssign();
     Expr *parseIfElse();
     Expr *parseLoop();
     Expr *parseExpression();
+    // binary operators of precedence MinPrec or higher, by precedence climbing
+    Expr *parseBinary(unsigned MinPrec);
+    // recursive descent, one function per precedence level
+    Expr *parseLogicalOr();
     Expr *parseDisjunction();
     Expr *parseConjunction();
     Expr *parseEquality();
@@ -64,7 +92,9 @@ class Parser
 
 public:
     // initializes all members and retrieves the first token
-    Parser(Lexer &Lex) : Lex(Lex), HasError(false)
+    Parser(Lexer &Lex, unsigned ErrorLimit = 0)
+        : Lex(Lex), HasError(false), Recovering(false), NumErrors(0),
+          ErrorLimit(ErrorLimit), NumAssignments(0), PrecedenceClimbing(true)
     {
         advance();
     }
@@ -73,6 +103,13 @@ public:
     bool hasError() { return HasError; }
 
     AST *parse();
+
+    // choose between the precedence climbing expression parser, the default, and the
+    // recursive descent one; both build the same trees
+    void setPrecedenceClimbing(bool Enable) { PrecedenceClimbing = Enable; }
+
+    // parses the input one top-level statement at a time, the caller owns the result
+    Expr *parseNext();
 };
 
 #endif
@@ -3,7 +3,7 @@
 #include "llvm/Support/raw_ostream.h"
 
 namespace {
-class InputCheck : public ASTVisitor {
+class InputCheck : public StaticASTVisitor<InputCheck> {
   llvm::StringSet<> Scope; // StringSet to store declared variables
   bool HasError; // Flag to indicate if an error occurred
 
@@ -23,15 +23,15 @@ public:
   bool hasError() { return HasError; } // Function to check if an error occurred
 
   // Visit function for AP nodes
-  virtual void visit(AP &Node) override { 
+  void visit(AP &Node) { 
     for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
     {
-      (*I)->accept(*this); // Visit each child node
+      dispatch(*I); // Visit each child node
     }
   };
 
   // Visit function for Factor nodes
-  virtual void visit(Factor &Node) override {
+  void visit(Factor &Node) {
     if (Node.getKind() == Factor::Ident) {
       // Check if identifier is in the scope
       if (Scope.find(Node.getVal()) == Scope.end())
@@ -40,22 +40,22 @@ public:
   };
 
   // Visit function for BinaryOp nodes
-  virtual void visit(BinaryOp &Node) override {
+  void visit(BinaryOp &Node) {
     if (Node.getLeft())
-      Node.getLeft()->accept(*this);
+      dispatch(Node.getLeft());
     else
       HasError = true;
 
     auto right = Node.getRight();
     if (right)
-      right->accept(*this);
+      dispatch(right);
     else
       HasError = true;
 
     if (Node.getOperator() == BinaryOp::Operator::Div && right) {
-      Factor * f = (Factor *)right;
+      Factor *f = llvm::dyn_cast<Factor>(right);
 
-      if (right && f->getKind() == Factor::ValueKind::Number) {
+      if (f && f->getKind() == Factor::ValueKind::Number) {
         int intval;
         f->getVal().getAsInteger(10, intval);
 
@@ -68,10 +68,10 @@ public:
   };
 
   // Visit function for Assignment nodes
-  virtual void visit(Assignment &Node) override {
+  void visit(Assignment &Node) {
     Factor *dest = Node.getLeft();
 
-    dest->accept(*this);
+    dispatch(dest);
 
     if (dest->getKind() == Factor::Number) {
         llvm::errs() << "Assignment destination must be an identifier.";
@@ -85,10 +85,10 @@ public:
     }
 
     if (Node.getRight())
-      Node.getRight()->accept(*this);
+      dispatch(Node.getRight());
   };
 
-  virtual void visit(Declaration &Node) override {
+  void visit(Declaration &Node) {
     for (auto I = Node.beginVars(), E = Node.endVars(); I != E;
          ++I) {
       if (!Scope.insert(*I).second)
@@ -99,14 +99,26 @@ public:
     {
     for (auto I = Node.beginExprs(),E = Node.endExprs();I != E ; ++I)
     {
-      (*I)->accept(*this);
+      dispatch(*I);
     }
     }
   };
 
-  virtual void visit(IfElse &) override {}; 
+  void visit(IfElse &Node) {
+    for (auto I = Node.beginExprs(), E = Node.endExprs(); I != E; ++I)
+      dispatch(*I);
 
-  virtual void visit(Loop &) override {};
+    for (auto I = Node.beginAssigns2D(), E = Node.endAssigns2D(); I != E; ++I)
+      for (Assignment *A : *I)
+        dispatch(A);
+  };
+
+  void visit(Loop &Node) {
+    dispatch(Node.getCondition());
+
+    for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
+      dispatch(*I);
+  };
 };
 }
 
@@ -115,7 +127,7 @@ bool Sema::semantic(AST *Tree) {
     return false; // If the input AST is not valid, return false indicating no errors
 
   InputCheck Check; // Create an instance of the InputCheck class for semantic analysis
-  Tree->accept(Check); // Initiate the semantic analysis by traversing the AST using the accept function
+  Check.dispatch(Tree); // Initiate the semantic analysis by traversing the AST
 
   return Check.hasError(); // Return the result of Check.hasError() indicating if any errors were detected during the analysis
 }
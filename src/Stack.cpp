@@ -0,0 +1,62 @@
+#include "Stack.h"
+#include "llvm/Support/Compiler.h"
+// thread.h uses std::terminate without including its header
+#include <exception>
+#include "llvm/Support/thread.h"
+#include <cstdint>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+namespace
+{
+  // stack of the threads started by runOnNewStack
+  const size_t ThreadStackSize = 8 << 20;
+  // kept free for the frames between two checks, including LLVM's
+  const size_t Headroom = 256 << 10;
+
+  thread_local uintptr_t StackBottom = 0;
+  thread_local size_t StackBudget = 0;
+
+  LLVM_ATTRIBUTE_NOINLINE uintptr_t getStackPointer()
+  {
+    volatile char Local = 0;
+    return reinterpret_cast<uintptr_t>(&Local);
+  }
+}
+
+void noteBottomOfStack(size_t Size)
+{
+  StackBottom = getStackPointer();
+  StackBudget = Size > 2 * Headroom ? Size - Headroom : Size / 2;
+}
+
+void noteBottomOfMainStack()
+{
+  // 1 MiB is the default of Windows, the smallest of the common ones
+  size_t Size = 1 << 20;
+#if defined(__unix__) || defined(__APPLE__)
+  struct rlimit Limit;
+  if (!getrlimit(RLIMIT_STACK, &Limit))
+    Size = Limit.rlim_cur == RLIM_INFINITY ? ThreadStackSize : Limit.rlim_cur;
+#endif
+  noteBottomOfStack(Size);
+}
+
+bool isStackNearlyExhausted()
+{
+  if (!StackBottom)
+    return false;
+  uintptr_t SP = getStackPointer();
+  size_t Used = SP < StackBottom ? StackBottom - SP : SP - StackBottom;
+  return Used > StackBudget;
+}
+
+void runOnNewStackImpl(llvm::function_ref<void()> Fn)
+{
+  llvm::thread Thread(llvm::Optional<unsigned>(ThreadStackSize), [Fn] {
+    noteBottomOfStack(ThreadStackSize);
+    Fn();
+  });
+  Thread.join();
+}
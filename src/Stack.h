@@ -0,0 +1,41 @@
+#ifndef STACK_H
+#define STACK_H
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include <cstddef>
+#include <type_traits>
+
+// Expressions are walked recursively, one native frame or more per nesting level.
+// Recursive functions check the stack left to their thread first; when it runs low
+// they continue on a new thread with a fresh stack and wait for it. Nesting depth
+// is then bounded by memory instead of by the stack size limit.
+
+// record the current frame as the bottom of a stack of Size bytes; threads that
+// never call it are not checked
+void noteBottomOfStack(size_t Size);
+
+// same for the main thread, taking the size from the stack size limit
+void noteBottomOfMainStack();
+
+// whether the current thread is too close to the end of its stack to recurse
+bool isStackNearlyExhausted();
+
+void runOnNewStackImpl(llvm::function_ref<void()> Fn);
+
+// run Fn on a new thread with a fresh stack and return its result
+template <typename Fn>
+auto runOnNewStack(Fn &&F) -> std::enable_if_t<std::is_void<decltype(F())>::value>
+{
+  runOnNewStackImpl(F);
+}
+
+template <typename Fn>
+auto runOnNewStack(Fn &&F) -> std::enable_if_t<!std::is_void<decltype(F())>::value, decltype(F())>
+{
+  llvm::Optional<decltype(F())> Result;
+  runOnNewStackImpl([&] { Result = F(); });
+  return std::move(*Result);
+}
+
+#endif
@@ -0,0 +1,55 @@
+# Runs one regression test added by ap_test in CMakeLists.txt: the program is run
+# by ap, or compiled and linked with the runtime, with INPUT on stdin, and what it
+# writes must be the contents of EXPECTED. With FAILS set, ap must reject the
+# program with exit status 1, and EXPECTED holds what it writes to stderr. The
+# compiled program runs with the variables of ENVIRONMENT set.
+
+separate_arguments(OPTIONS UNIX_COMMAND "${OPTIONS}")
+separate_arguments(ENVIRONMENT UNIX_COMMAND "${ENVIRONMENT}")
+file(MAKE_DIRECTORY ${WORK_DIR})
+if(NOT EXISTS ${INPUT})
+  set(INPUT ${WORK_DIR}/empty.in)
+  file(WRITE ${INPUT} "")
+endif()
+
+if(MODE STREQUAL "run")
+  execute_process(COMMAND ${AP} ${OPTIONS} -input-file ${PROGRAM}
+                  INPUT_FILE ${INPUT}
+                  OUTPUT_VARIABLE Output
+                  ERROR_VARIABLE Errors
+                  RESULT_VARIABLE Result)
+  if(FAILS)
+    if(NOT Result EQUAL 1)
+      message(FATAL_ERROR "ap exited with ${Result} instead of 1:\n${Errors}")
+    endif()
+    set(Output "${Errors}")
+  elseif(NOT Result EQUAL 0)
+    message(FATAL_ERROR "ap failed (${Result}):\n${Errors}")
+  endif()
+else()
+  execute_process(COMMAND ${AP} ${OPTIONS} -emit-obj -o ${WORK_DIR}/program.o -input-file ${PROGRAM}
+                  ERROR_VARIABLE Errors
+                  RESULT_VARIABLE Result)
+  if(NOT Result EQUAL 0)
+    message(FATAL_ERROR "ap failed (${Result}):\n${Errors}")
+  endif()
+  execute_process(COMMAND ${CC} ${WORK_DIR}/program.o ${RUNTIME} -pthread -o ${WORK_DIR}/program
+                  ERROR_VARIABLE Errors
+                  RESULT_VARIABLE Result)
+  if(NOT Result EQUAL 0)
+    message(FATAL_ERROR "Linking failed (${Result}):\n${Errors}")
+  endif()
+  execute_process(COMMAND ${CMAKE_COMMAND} -E env ${ENVIRONMENT} ${WORK_DIR}/program
+                  INPUT_FILE ${INPUT}
+                  OUTPUT_VARIABLE Output
+                  ERROR_VARIABLE Errors
+                  RESULT_VARIABLE Result)
+  if(NOT Result EQUAL 0)
+    message(FATAL_ERROR "The program failed (${Result}):\n${Errors}")
+  endif()
+endif()
+
+file(READ ${EXPECTED} Expected)
+if(NOT Output STREQUAL Expected)
+  message(FATAL_ERROR "Expected:\n${Expected}\nbut the program wrote:\n${Output}")
+endif()